@@ -0,0 +1,474 @@
+// Benchmark of the search server's public operations over a generated
+// corpus. Every run with the same options and seed generates the same
+// corpus and queries. Results go out as JSON, a summary to std::cerr:
+//
+//     benchmark --documents=100000 --zipf=1.1 --output=results.json
+//
+// Options (defaults in Options below): --documents, --document-words,
+// --dictionary, --queries, --query-words, --minus-prob, --zipf, --seed,
+// --threads, --repetitions, --output.
+#include "../generators.h"
+#include "../process_queries.h"
+#include "../remove_duplicates.h"
+#include "../search_server.h"
+#include "../thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <execution>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    int documents = 20'000;
+    int document_words = 70;
+    int dictionary = 10'000;
+    int queries = 1'000;
+    int query_words = 10;
+    double minus_prob = 0.1;
+    double zipf = 1.0;  // 0 draws words uniformly, as main.cpp does
+    unsigned seed = 5489;
+    size_t threads = 0;  // of the default ThreadPool, 0 for one per hardware thread
+    int repetitions = 3;  // of the benchmarks that rebuild the index
+    string output;  // std::cout if empty
+};
+
+Options ParseOptions(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const string_view argument = argv[i];
+        const size_t equals = argument.find('=');
+        if (argument.substr(0, 2) != "--"sv || equals == string_view::npos) {
+            throw invalid_argument("expected --name=value, got "s + string(argument));
+        }
+        const string_view name = argument.substr(2, equals - 2);
+        const string value(argument.substr(equals + 1));
+        if (name == "documents"sv) {
+            options.documents = stoi(value);
+        }
+        else if (name == "document-words"sv) {
+            options.document_words = stoi(value);
+        }
+        else if (name == "dictionary"sv) {
+            options.dictionary = stoi(value);
+        }
+        else if (name == "queries"sv) {
+            options.queries = stoi(value);
+        }
+        else if (name == "query-words"sv) {
+            options.query_words = stoi(value);
+        }
+        else if (name == "minus-prob"sv) {
+            options.minus_prob = stod(value);
+        }
+        else if (name == "zipf"sv) {
+            options.zipf = stod(value);
+        }
+        else if (name == "seed"sv) {
+            options.seed = static_cast<unsigned>(stoul(value));
+        }
+        else if (name == "threads"sv) {
+            options.threads = stoul(value);
+        }
+        else if (name == "repetitions"sv) {
+            options.repetitions = stoi(value);
+        }
+        else if (name == "output"sv) {
+            options.output = value;
+        }
+        else {
+            throw invalid_argument("unknown option "s + string(name));
+        }
+    }
+    if (options.documents <= 0 || options.dictionary <= 0 || options.queries <= 0 || options.repetitions <= 0) {
+        throw invalid_argument("sizes must be positive"s);
+    }
+    return options;
+}
+
+// Resident set size in bytes, 0 where /proc is not available
+int64_t ReadMemoryStat(string_view field) {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (string_view(line).substr(0, field.size()) == field) {
+            istringstream values(line.substr(field.size() + 1));
+            int64_t kilobytes = 0;
+            values >> kilobytes;
+            return kilobytes * 1024;
+        }
+    }
+    return 0;
+}
+
+int64_t GetResidentBytes() {
+    return ReadMemoryStat("VmRSS"sv);
+}
+
+int64_t GetPeakResidentBytes() {
+    return ReadMemoryStat("VmHWM"sv);
+}
+
+struct Corpus {
+    vector<string> dictionary;
+    vector<string> texts;
+    vector<DocumentStatus> statuses;
+    vector<vector<int>> ratings;
+    vector<string> queries;
+
+    vector<NewDocument> MakeBatch() const {
+        vector<NewDocument> batch;
+        batch.reserve(texts.size());
+        for (size_t i = 0; i < texts.size(); ++i) {
+            batch.push_back({ static_cast<int>(i), texts[i], statuses[i], ratings[i] });
+        }
+        return batch;
+    }
+};
+
+Corpus GenerateCorpus(const Options& options) {
+    mt19937 generator(options.seed);
+    Corpus corpus;
+    corpus.dictionary = GenerateDictionary(generator, options.dictionary, 10);
+    const ZipfianDistribution distribution(corpus.dictionary.size(), options.zipf);
+    corpus.texts = GenerateZipfianQueries(generator, corpus.dictionary, distribution, options.documents,
+        options.document_words);
+    for (int i = 0; i < options.documents; ++i) {
+        // Three in four documents are ACTUAL, as FindTopDocuments looks for by default
+        corpus.statuses.push_back(i % 4 == 3 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL);
+        corpus.ratings.push_back({ uniform_int_distribution(-10, 10)(generator), uniform_int_distribution(-10, 10)(generator) });
+    }
+    corpus.queries = GenerateZipfianQueries(generator, corpus.dictionary, distribution, options.queries,
+        options.query_words, options.minus_prob);
+    return corpus;
+}
+
+// Latencies of the operations of one benchmark, in nanoseconds
+class Recorder {
+public:
+    using Clock = chrono::steady_clock;
+
+    explicit Recorder(string name, size_t items_per_operation = 1)
+        : name_(move(name))
+        , items_per_operation_(items_per_operation)
+    {
+    }
+
+    template <typename Operation>
+    void Measure(Operation operation) {
+        const Clock::time_point start = Clock::now();
+        operation();
+        latencies_.push_back(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count());
+    }
+
+    string ToJson() const {
+        vector<int64_t> sorted = latencies_;
+        sort(sorted.begin(), sorted.end());
+        const int64_t total = accumulate(sorted.begin(), sorted.end(), int64_t{ 0 });
+        const double seconds = total / 1e9;
+        const double items = static_cast<double>(sorted.size() * items_per_operation_);
+        ostringstream json;
+        json << "{\"name\": \"" << name_ << "\""
+            << ", \"operations\": " << sorted.size()
+            << ", \"items_per_operation\": " << items_per_operation_
+            << ", \"total_ns\": " << total
+            << ", \"min_ns\": " << (sorted.empty() ? 0 : sorted.front())
+            << ", \"p50_ns\": " << Percentile(sorted, 0.50)
+            << ", \"p90_ns\": " << Percentile(sorted, 0.90)
+            << ", \"p99_ns\": " << Percentile(sorted, 0.99)
+            << ", \"max_ns\": " << (sorted.empty() ? 0 : sorted.back())
+            << ", \"mean_ns\": " << (sorted.empty() ? 0 : total / static_cast<int64_t>(sorted.size()))
+            << ", \"items_per_second\": " << (seconds > 0 ? items / seconds : 0.0)
+            << ", \"rss_bytes\": " << rss_bytes_
+            << ", \"peak_rss_bytes\": " << peak_rss_bytes_
+            << "}";
+        return json.str();
+    }
+
+    // Memory as of the end of the benchmark
+    void RecordMemory() {
+        rss_bytes_ = GetResidentBytes();
+        peak_rss_bytes_ = GetPeakResidentBytes();
+    }
+
+    string ToText() const {
+        vector<int64_t> sorted = latencies_;
+        sort(sorted.begin(), sorted.end());
+        ostringstream text;
+        text << name_ << ": " << sorted.size() << " ops, p50 " << Percentile(sorted, 0.50)
+            << " ns, p99 " << Percentile(sorted, 0.99) << " ns";
+        return text.str();
+    }
+
+private:
+    // Nearest rank
+    static int64_t Percentile(const vector<int64_t>& sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        const size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+        return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+    }
+
+    string name_;
+    size_t items_per_operation_;
+    vector<int64_t> latencies_;
+    int64_t rss_bytes_ = 0;
+    int64_t peak_rss_bytes_ = 0;
+};
+
+class Suite {
+public:
+    Recorder& Add(string name, size_t items_per_operation = 1) {
+        recorders_.push_back(make_unique<Recorder>(move(name), items_per_operation));
+        return *recorders_.back();
+    }
+
+    void Finish(Recorder& recorder) const {
+        recorder.RecordMemory();
+        cerr << recorder.ToText() << endl;
+    }
+
+    void WriteJson(ostream& out, const Options& options) const {
+        out << "{\n  \"options\": {"
+            << "\"documents\": " << options.documents
+            << ", \"document_words\": " << options.document_words
+            << ", \"dictionary\": " << options.dictionary
+            << ", \"queries\": " << options.queries
+            << ", \"query_words\": " << options.query_words
+            << ", \"minus_prob\": " << options.minus_prob
+            << ", \"zipf\": " << options.zipf
+            << ", \"seed\": " << options.seed
+            << ", \"threads\": " << ThreadPool::GetDefault()->GetThreadCount()
+            << ", \"repetitions\": " << options.repetitions
+            << "},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < recorders_.size(); ++i) {
+            out << (i > 0 ? "," : "") << "\n    " << recorders_[i]->ToJson();
+        }
+        out << "\n  ]\n}" << endl;
+    }
+
+private:
+    vector<unique_ptr<Recorder>> recorders_;
+};
+
+// Keeps the compiler from dropping results nobody reads
+volatile double benchmark_sink = 0;
+
+void Consume(const vector<Document>& documents) {
+    for (const Document& document : documents) {
+        benchmark_sink = benchmark_sink + document.relevance;
+    }
+}
+
+unique_ptr<SearchServer> BulkLoad(const Corpus& corpus) {
+    auto search_server = make_unique<SearchServer>(corpus.dictionary[0]);
+    search_server->AddDocuments(execution::par, corpus.MakeBatch());
+    return search_server;
+}
+
+void RunIndexingBenchmarks(Suite& suite, const Options& options, const Corpus& corpus) {
+    Recorder& add_document = suite.Add("add_document");
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        SearchServer search_server(corpus.dictionary[0]);
+        for (size_t i = 0; i < corpus.texts.size(); ++i) {
+            add_document.Measure([&] {
+                search_server.AddDocument(static_cast<int>(i), corpus.texts[i], corpus.statuses[i], corpus.ratings[i]);
+            });
+        }
+    }
+    suite.Finish(add_document);
+
+    const vector<NewDocument> batch = corpus.MakeBatch();
+    Recorder& bulk_load_seq = suite.Add("bulk_load_seq", batch.size());
+    Recorder& bulk_load_par = suite.Add("bulk_load_par", batch.size());
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        SearchServer seq_server(corpus.dictionary[0]);
+        bulk_load_seq.Measure([&] { seq_server.AddDocuments(execution::seq, batch); });
+        SearchServer par_server(corpus.dictionary[0]);
+        bulk_load_par.Measure([&] { par_server.AddDocuments(execution::par, batch); });
+    }
+    suite.Finish(bulk_load_seq);
+    suite.Finish(bulk_load_par);
+
+    // A tenth of the documents, spread over the ordinals
+    const int removed_count = max(1, options.documents / 10);
+    Recorder& remove_seq = suite.Add("remove_document_seq");
+    Recorder& remove_par = suite.Add("remove_document_par");
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        for (auto [recorder, is_parallel] : { pair{ &remove_seq, false }, pair{ &remove_par, true } }) {
+            const unique_ptr<SearchServer> search_server = BulkLoad(corpus);
+            for (int i = 0; i < removed_count; ++i) {
+                const int document_id = static_cast<int>(static_cast<int64_t>(i) * options.documents / removed_count);
+                recorder->Measure([&] {
+                    if (is_parallel) {
+                        search_server->RemoveDocument(execution::par, document_id);
+                    }
+                    else {
+                        search_server->RemoveDocument(execution::seq, document_id);
+                    }
+                });
+            }
+        }
+    }
+    suite.Finish(remove_seq);
+    suite.Finish(remove_par);
+
+    // Every fifth document repeats the words of an earlier one in another order
+    const auto add_documents_with_duplicates = [&corpus](SearchServer& search_server) {
+        for (size_t i = 0; i < corpus.texts.size(); ++i) {
+            if (i % 5 == 4) {
+                vector<string_view> words = SplitIntoWordsView(corpus.texts[i / 2]);
+                reverse(words.begin(), words.end());
+                string text;
+                for (const string_view word : words) {
+                    text.append(word).push_back(' ');
+                }
+                search_server.AddDocument(static_cast<int>(i), text, corpus.statuses[i], corpus.ratings[i]);
+            }
+            else {
+                search_server.AddDocument(static_cast<int>(i), corpus.texts[i], corpus.statuses[i], corpus.ratings[i]);
+            }
+        }
+    };
+    Recorder& remove_duplicates_seq = suite.Add("remove_duplicates_seq", corpus.texts.size());
+    Recorder& remove_duplicates_par = suite.Add("remove_duplicates_par", corpus.texts.size());
+    Recorder& remove_near_duplicates = suite.Add("remove_near_duplicates_par", corpus.texts.size());
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        SearchServer seq_server(corpus.dictionary[0]);
+        add_documents_with_duplicates(seq_server);
+        remove_duplicates_seq.Measure([&] { RemoveDuplicates(execution::seq, seq_server); });
+        SearchServer par_server(corpus.dictionary[0]);
+        add_documents_with_duplicates(par_server);
+        remove_duplicates_par.Measure([&] { RemoveDuplicates(execution::par, par_server); });
+        SearchServer near_server(corpus.dictionary[0]);
+        add_documents_with_duplicates(near_server);
+        remove_near_duplicates.Measure([&] { RemoveNearDuplicates(execution::par, near_server); });
+    }
+    suite.Finish(remove_duplicates_seq);
+    suite.Finish(remove_duplicates_par);
+    suite.Finish(remove_near_duplicates);
+}
+
+void RunQueryBenchmarks(Suite& suite, const Options& options, const Corpus& corpus) {
+    const unique_ptr<SearchServer> search_server = BulkLoad(corpus);
+    const auto is_even = [](int document_id, DocumentStatus, int) { return document_id % 2 == 0; };
+
+    Recorder& find_seq = suite.Add("find_top_documents_seq");
+    Recorder& find_par = suite.Add("find_top_documents_par");
+    Recorder& find_status = suite.Add("find_top_documents_by_status");
+    Recorder& find_predicate = suite.Add("find_top_documents_by_predicate");
+    Recorder& find_predicate_par = suite.Add("find_top_documents_by_predicate_par");
+    for (const string& query : corpus.queries) {
+        find_seq.Measure([&] { Consume(search_server->FindTopDocuments(execution::seq, query)); });
+        find_par.Measure([&] { Consume(search_server->FindTopDocuments(execution::par, query)); });
+        find_status.Measure([&] { Consume(search_server->FindTopDocuments(query, DocumentStatus::BANNED)); });
+        find_predicate.Measure([&] { Consume(search_server->FindTopDocuments(query, is_even)); });
+        find_predicate_par.Measure([&] { Consume(search_server->FindTopDocuments(execution::par, query, is_even)); });
+    }
+    for (Recorder* recorder : { &find_seq, &find_par, &find_status, &find_predicate, &find_predicate_par }) {
+        suite.Finish(*recorder);
+    }
+
+    // Words at the tail of the Zipfian ranks are in a handful of documents,
+    // so a query for one costs little beyond the size of the index
+    Recorder& find_rare = suite.Add("find_top_documents_rare_term");
+    Recorder& find_rare_exhaustive = suite.Add("find_top_documents_rare_term_exhaustive");
+    const size_t rare_word_count = min<size_t>(corpus.dictionary.size(), 100);
+    for (size_t i = corpus.dictionary.size() - rare_word_count; i < corpus.dictionary.size(); ++i) {
+        const string& word = corpus.dictionary[i];
+        search_server->SetScoringMode(ScoringMode::MAX_SCORE);
+        find_rare.Measure([&] { Consume(search_server->FindTopDocuments(word)); });
+        search_server->SetScoringMode(ScoringMode::EXHAUSTIVE);
+        find_rare_exhaustive.Measure([&] { Consume(search_server->FindTopDocuments(word)); });
+    }
+    search_server->SetScoringMode(ScoringMode::MAX_SCORE);
+    suite.Finish(find_rare);
+    suite.Finish(find_rare_exhaustive);
+
+    Recorder& match_seq = suite.Add("match_document_seq");
+    Recorder& match_par = suite.Add("match_document_par");
+    for (size_t i = 0; i < corpus.queries.size(); ++i) {
+        const int document_id = static_cast<int>(i % corpus.texts.size());
+        match_seq.Measure([&] {
+            benchmark_sink = benchmark_sink
+                + get<0>(search_server->MatchDocument(execution::seq, corpus.queries[i], document_id)).size();
+        });
+        match_par.Measure([&] {
+            benchmark_sink = benchmark_sink
+                + get<0>(search_server->MatchDocument(execution::par, corpus.queries[i], document_id)).size();
+        });
+    }
+    suite.Finish(match_seq);
+    suite.Finish(match_par);
+
+    // One query against every document, as a results page matches its rows
+    const vector<int> document_ids(search_server->begin(), search_server->end());
+    Recorder& match_documents_seq = suite.Add("match_documents_seq", document_ids.size());
+    Recorder& match_documents_par = suite.Add("match_documents_par", document_ids.size());
+    for (size_t i = 0; i < corpus.queries.size() && i < 10; ++i) {
+        match_documents_seq.Measure([&] {
+            benchmark_sink = benchmark_sink
+                + search_server->MatchDocuments(execution::seq, corpus.queries[i], document_ids).size();
+        });
+        match_documents_par.Measure([&] {
+            benchmark_sink = benchmark_sink
+                + search_server->MatchDocuments(execution::par, corpus.queries[i], document_ids).size();
+        });
+    }
+    suite.Finish(match_documents_seq);
+    suite.Finish(match_documents_par);
+
+    Recorder& process_queries = suite.Add("process_queries", corpus.queries.size());
+    Recorder& process_queries_joined = suite.Add("process_queries_joined", corpus.queries.size());
+    for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+        process_queries.Measure([&] {
+            for (const vector<Document>& documents : ProcessQueries(*search_server, corpus.queries)) {
+                Consume(documents);
+            }
+        });
+        process_queries_joined.Measure([&] { Consume(ProcessQueriesJoined(*search_server, corpus.queries)); });
+    }
+    suite.Finish(process_queries);
+    suite.Finish(process_queries_joined);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        const Options options = ParseOptions(argc, argv);
+        if (options.threads > 0) {
+            ThreadPool::SetDefaultThreadCount(options.threads);
+        }
+        const Corpus corpus = GenerateCorpus(options);
+
+        Suite suite;
+        RunIndexingBenchmarks(suite, options, corpus);
+        RunQueryBenchmarks(suite, options, corpus);
+
+        if (options.output.empty()) {
+            suite.WriteJson(cout, options);
+        }
+        else {
+            ofstream out(options.output);
+            suite.WriteJson(out, options);
+            if (!out) {
+                throw runtime_error("can't write "s + options.output);
+            }
+        }
+    }
+    catch (const exception& e) {
+        cerr << "benchmark: "s << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,280 @@
+#include "compressed_postings.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+static void WriteVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static uint32_t ReadVarint(const uint8_t*& in) {
+    uint32_t value = *in & 0x7F;
+    for (int shift = 7; *in++ & 0x80; shift += 7) {
+        value |= static_cast<uint32_t>(*in & 0x7F) << shift;
+    }
+    return value;
+}
+
+CompressedPostingsList::CompressedPostingsList(FlatArray<BlockHeader> blocks, FlatArray<uint8_t> data,
+    size_t size, double max_term_freq)
+    : blocks_(move(blocks))
+    , data_(move(data))
+    , size_(size)
+    , max_term_freq_(max_term_freq)
+{
+}
+
+void CompressedPostingsList::Insert(uint32_t ordinal, uint32_t term_count, uint32_t word_count) {
+    max_term_freq_ = max(max_term_freq_, ComputeTermFreq(term_count, word_count));
+    if (blocks_.empty() || blocks_.back().last_ordinal < ordinal) {
+        vector<BlockHeader>& blocks = blocks_.Mutable();
+        vector<uint8_t>& data = data_.Mutable();
+        if (blocks.empty() || blocks.back().size == BLOCK_SIZE) {
+            blocks.push_back({ ordinal, ordinal, static_cast<uint32_t>(data.size()), 1 });
+        }
+        else {
+            BlockHeader& block = blocks.back();
+            WriteVarint(data, ordinal - block.last_ordinal);
+            block.last_ordinal = ordinal;
+            ++block.size;
+        }
+        WriteVarint(data, term_count);
+        WriteVarint(data, word_count);
+        ++size_;
+        return;
+    }
+
+    const size_t block_index = FindBlock(ordinal);
+    vector<Posting> postings = DecodePostings(block_index);
+    const auto it = lower_bound(postings.begin(), postings.end(), ordinal,
+        [](const Posting& posting, uint32_t ordinal) {
+            return posting.ordinal < ordinal;
+        }
+    );
+    if (it != postings.end() && it->ordinal == ordinal) {
+        it->term_count = term_count;
+        it->word_count = word_count;
+    }
+    else {
+        postings.insert(it, { ordinal, term_count, word_count });
+        ++size_;
+    }
+    RewriteBlock(block_index, postings);
+}
+
+bool CompressedPostingsList::Erase(uint32_t ordinal) {
+    const size_t block_index = FindBlock(ordinal);
+    if (block_index == blocks_.size() || blocks_[block_index].first_ordinal > ordinal) {
+        return false;
+    }
+    vector<Posting> postings = DecodePostings(block_index);
+    const auto it = find_if(postings.begin(), postings.end(),
+        [ordinal](const Posting& posting) {
+            return posting.ordinal == ordinal;
+        }
+    );
+    if (it == postings.end()) {
+        return false;
+    }
+    postings.erase(it);
+    RewriteBlock(block_index, postings);
+    if (--size_ == 0) {
+        max_term_freq_ = 0.0;
+    }
+    return true;
+}
+
+size_t CompressedPostingsList::EraseAndRenumber(const vector<uint32_t>& erased_ordinals) {
+    if (erased_ordinals.empty()) {
+        return 0;
+    }
+    const size_t first_block = FindBlock(erased_ordinals.front());
+    if (first_block == blocks_.size()) {
+        return 0;
+    }
+    // The blocks before first_block keep their ordinals and are copied as they
+    // are. Appending is O(1) per posting, so the rest is rebuilt rather than
+    // having every touched block spliced into the data.
+    CompressedPostingsList kept;
+    kept.blocks_ = FlatArray<BlockHeader>(vector<BlockHeader>(blocks_.begin(), blocks_.begin() + first_block));
+    kept.data_ = FlatArray<uint8_t>(vector<uint8_t>(data_.begin(), data_.begin() + blocks_[first_block].offset));
+    for (const BlockHeader& block : kept.blocks_) {
+        kept.size_ += block.size;
+    }
+    // Still a bound for the copied blocks, which are not decoded
+    kept.max_term_freq_ = first_block > 0 ? max_term_freq_ : 0.0;
+    auto erased_it = erased_ordinals.begin();
+    for (size_t block_index = first_block; block_index < blocks_.size(); ++block_index) {
+        for (const Posting& posting : DecodePostings(block_index)) {
+            while (erased_it != erased_ordinals.end() && *erased_it < posting.ordinal) {
+                ++erased_it;
+            }
+            if (erased_it == erased_ordinals.end() || *erased_it != posting.ordinal) {
+                const uint32_t ordinal = posting.ordinal - static_cast<uint32_t>(erased_it - erased_ordinals.begin());
+                kept.Insert(ordinal, posting.term_count, posting.word_count);
+            }
+        }
+    }
+    const size_t erased_count = size_ - kept.size_;
+    *this = move(kept);
+    return erased_count;
+}
+
+bool CompressedPostingsList::Contains(uint32_t ordinal) const {
+    const size_t block_index = FindBlock(ordinal);
+    if (block_index == blocks_.size()) {
+        return false;
+    }
+    const BlockHeader& block = blocks_[block_index];
+    if (block.first_ordinal >= ordinal) {
+        return block.first_ordinal == ordinal;
+    }
+
+    const uint8_t* in = data_.data() + block.offset;
+    uint32_t current = block.first_ordinal;
+    ReadVarint(in);
+    ReadVarint(in);
+    for (uint32_t i = 1; i < block.size && current < ordinal; ++i) {
+        current += ReadVarint(in);
+        ReadVarint(in);
+        ReadVarint(in);
+    }
+    return current == ordinal;
+}
+
+size_t CompressedPostingsList::size() const {
+    return size_;
+}
+
+bool CompressedPostingsList::empty() const {
+    return size_ == 0;
+}
+
+double CompressedPostingsList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+const FlatArray<CompressedPostingsList::BlockHeader>& CompressedPostingsList::GetBlocks() const {
+    return blocks_;
+}
+
+const FlatArray<uint8_t>& CompressedPostingsList::GetData() const {
+    return data_;
+}
+
+size_t CompressedPostingsList::DecodeBlock(size_t block_index, uint32_t* ordinals, double* term_freqs) const {
+    const BlockHeader& block = blocks_[block_index];
+    const uint8_t* in = data_.data() + block.offset;
+    uint32_t ordinal = block.first_ordinal;
+    for (uint32_t i = 0; i < block.size; ++i) {
+        if (i > 0) {
+            ordinal += ReadVarint(in);
+        }
+        const uint32_t term_count = ReadVarint(in);
+        const uint32_t word_count = ReadVarint(in);
+        ordinals[i] = ordinal;
+        term_freqs[i] = ComputeTermFreq(term_count, word_count);
+    }
+    return block.size;
+}
+
+size_t CompressedPostingsList::GetEncodedBytes() const {
+    return data_.size() + blocks_.size() * sizeof(BlockHeader);
+}
+
+vector<CompressedPostingsList::Posting> CompressedPostingsList::DecodePostings(size_t block_index) const {
+    const BlockHeader& block = blocks_[block_index];
+    vector<Posting> postings(block.size);
+    const uint8_t* in = data_.data() + block.offset;
+    uint32_t ordinal = block.first_ordinal;
+    for (Posting& posting : postings) {
+        if (&posting != &postings.front()) {
+            ordinal += ReadVarint(in);
+        }
+        posting.ordinal = ordinal;
+        posting.term_count = ReadVarint(in);
+        posting.word_count = ReadVarint(in);
+    }
+    return postings;
+}
+
+void CompressedPostingsList::RewriteBlock(size_t block_index, const vector<Posting>& postings) {
+    // An insertion may overflow the block, so it is re-encoded as however many blocks it takes
+    const uint32_t data_begin = blocks_[block_index].offset;
+    const uint32_t data_end = block_index + 1 < blocks_.size()
+        ? blocks_[block_index + 1].offset : static_cast<uint32_t>(data_.size());
+
+    vector<BlockHeader> headers;
+    vector<uint8_t> encoded;
+    for (size_t i = 0; i < postings.size(); ++i) {
+        if (i % BLOCK_SIZE == 0) {
+            headers.push_back({ postings[i].ordinal, postings[i].ordinal,
+                data_begin + static_cast<uint32_t>(encoded.size()), 0 });
+        }
+        else {
+            WriteVarint(encoded, postings[i].ordinal - postings[i - 1].ordinal);
+        }
+        WriteVarint(encoded, postings[i].term_count);
+        WriteVarint(encoded, postings[i].word_count);
+        headers.back().last_ordinal = postings[i].ordinal;
+        ++headers.back().size;
+    }
+
+    vector<uint8_t>& data = data_.Mutable();
+    const auto data_it = data.erase(data.begin() + data_begin, data.begin() + data_end);
+    data.insert(data_it, encoded.begin(), encoded.end());
+    vector<BlockHeader>& blocks = blocks_.Mutable();
+    for (size_t i = block_index + 1; i < blocks.size(); ++i) {
+        blocks[i].offset = blocks[i].offset - (data_end - data_begin) + static_cast<uint32_t>(encoded.size());
+    }
+    const auto block_it = blocks.erase(blocks.begin() + block_index);
+    blocks.insert(block_it, headers.begin(), headers.end());
+}
+
+size_t CompressedPostingsList::FindBlock(uint32_t ordinal) const {
+    return lower_bound(blocks_.begin(), blocks_.end(), ordinal,
+        [](const BlockHeader& block, uint32_t ordinal) {
+            return block.last_ordinal < ordinal;
+        }
+    ) - blocks_.begin();
+}
+
+void CompressedPostingsCursor::SeekTo(uint32_t target) {
+    if (AtEnd() || ordinals_[pos_] >= target) {
+        return;
+    }
+    const FlatArray<CompressedPostingsList::BlockHeader>& blocks = postings_->GetBlocks();
+    if (blocks[block_].last_ordinal < target) {
+        // Gallops over the headers, the way PostingsCursor does over ordinals
+        const auto before_target = [](const CompressedPostingsList::BlockHeader& block, uint32_t target) {
+            return block.last_ordinal < target;
+        };
+        size_t step = 1;
+        size_t low = block_ + 1;
+        size_t high = low + step;
+        while (high < blocks.size() && blocks[high].last_ordinal < target) {
+            low = high;
+            step *= 2;
+            high = low + step;
+        }
+        high = min(high, blocks.size());
+        LoadBlock(lower_bound(blocks.begin() + low, blocks.begin() + high, target, before_target) - blocks.begin());
+        if (AtEnd()) {
+            return;
+        }
+    }
+    pos_ = lower_bound(ordinals_.begin() + pos_, ordinals_.begin() + block_size_, target) - ordinals_.begin();
+}
+
+void CompressedPostingsCursor::LoadBlock(size_t block_index) {
+    block_ = block_index;
+    pos_ = 0;
+    block_size_ = block_index < postings_->GetBlocks().size()
+        ? postings_->DecodeBlock(block_index, ordinals_.data(), term_freqs_.data()) : 0;
+}
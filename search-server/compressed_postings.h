@@ -0,0 +1,130 @@
+#pragma once
+#include "flat_array.h"
+#include "postings.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CompressedPostingsCursor;
+
+// Postings of a single term packed into blocks of up to BLOCK_SIZE entries.
+// Inside a block every posting is a run of variable-byte integers: the gap to
+// the previous ordinal (omitted for the first one, which is in the header),
+// the number of times the term occurs in the document and the document's word
+// count. The term frequency is rebuilt from the two counts, so nothing is lost
+// to quantization. Block headers double as a skip list: a cursor looks at the
+// last ordinal of a block to jump over it without decoding a byte.
+class CompressedPostingsList {
+public:
+    using Cursor = CompressedPostingsCursor;
+
+    static const size_t BLOCK_SIZE = 128;
+
+    struct BlockHeader {
+        uint32_t first_ordinal;
+        uint32_t last_ordinal;
+        uint32_t offset;  // of the block's first byte in the encoded data
+        uint32_t size;    // number of postings
+    };
+
+    CompressedPostingsList() = default;
+    // blocks and data as returned by GetBlocks and GetData, size postings in total
+    CompressedPostingsList(FlatArray<BlockHeader> blocks, FlatArray<uint8_t> data, size_t size, double max_term_freq);
+
+    // Appends to the last block when ordinal is greater than every stored one
+    // (always the case while indexing), otherwise re-encodes the block the
+    // ordinal belongs to. An already present ordinal gets its counts replaced.
+    void Insert(uint32_t ordinal, uint32_t term_count, uint32_t word_count);
+
+    // Returns false if the list has no such ordinal.
+    bool Erase(uint32_t ordinal);
+    // Erases every one of ordinals, sorted ascending, the list has and moves
+    // each ordinal left down by the number of ordinals below it, the way
+    // PostingsList::EraseAndRenumber does; returns how many of ordinals the
+    // list had. Re-encodes the list once from the block of the first of
+    // ordinals on, whatever their number.
+    size_t EraseAndRenumber(const std::vector<uint32_t>& ordinals);
+
+    bool Contains(uint32_t ordinal) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // Never below the largest term frequency in the list. Erasing keeps the
+    // old value rather than decoding everything again, which only makes
+    // pruning a bit less eager.
+    double GetMaxTermFreq() const;
+
+    const FlatArray<BlockHeader>& GetBlocks() const;
+    const FlatArray<uint8_t>& GetData() const;
+
+    // Decodes the block into ordinals and term_freqs, each BLOCK_SIZE long,
+    // and returns the number of postings written.
+    size_t DecodeBlock(size_t block_index, uint32_t* ordinals, double* term_freqs) const;
+
+    // Encoded data and block headers together
+    size_t GetEncodedBytes() const;
+
+private:
+    struct Posting {
+        uint32_t ordinal;
+        uint32_t term_count;
+        uint32_t word_count;
+    };
+
+    std::vector<Posting> DecodePostings(size_t block_index) const;
+    // Replaces the data of a block, dropping the block if postings is empty
+    void RewriteBlock(size_t block_index, const std::vector<Posting>& postings);
+    // Index of the block that holds ordinal if the list has it
+    size_t FindBlock(uint32_t ordinal) const;
+
+    FlatArray<BlockHeader> blocks_;
+    FlatArray<uint8_t> data_;
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+};
+
+// Forward-only position in a CompressedPostingsList. Holds the current block
+// decoded; the next one is decoded only when the cursor actually enters it.
+class CompressedPostingsCursor {
+public:
+    explicit CompressedPostingsCursor(const CompressedPostingsList& postings)
+        : postings_(&postings)
+    {
+        LoadBlock(0);
+    }
+
+    bool AtEnd() const {
+        return block_ == postings_->GetBlocks().size();
+    }
+
+    uint32_t GetOrdinal() const {
+        return ordinals_[pos_];
+    }
+
+    double GetTermFreq() const {
+        return term_freqs_[pos_];
+    }
+
+    void Next() {
+        if (++pos_ == block_size_) {
+            LoadBlock(block_ + 1);
+        }
+    }
+
+    // Moves to the first posting whose ordinal is not less than target,
+    // skipping whole blocks by their headers.
+    void SeekTo(uint32_t target);
+
+private:
+    void LoadBlock(size_t block_index);
+
+    const CompressedPostingsList* postings_;
+    size_t block_ = 0;
+    size_t block_size_ = 0;
+    size_t pos_ = 0;
+    std::array<uint32_t, CompressedPostingsList::BLOCK_SIZE> ordinals_;
+    std::array<double, CompressedPostingsList::BLOCK_SIZE> term_freqs_;
+};
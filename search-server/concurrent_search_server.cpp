@@ -0,0 +1,550 @@
+#include "concurrent_search_server.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+ConcurrentSearchServer::Snapshot::Snapshot(EpochManager::Guard guard, const Version* version,
+    const SearchServer* parser)
+    : guard_(move(guard))
+    , version_(version)
+    , parser_(parser)
+{
+}
+
+vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(string_view raw_query, DocumentStatus doc_status,
+    size_t max_result_count) const
+{
+    return FindTopDocuments(raw_query,
+        [doc_status](int document_id, DocumentStatus status, int rating) {
+            return status == doc_status;
+        },
+        max_result_count
+    );
+}
+
+vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(string_view raw_query) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(execution::parallel_policy policy,
+    string_view raw_query, DocumentStatus doc_status, size_t max_result_count) const
+{
+    return FindTopDocuments(policy, raw_query,
+        [doc_status](int document_id, DocumentStatus status, int rating) {
+            return status == doc_status;
+        },
+        max_result_count
+    );
+}
+
+vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(execution::parallel_policy policy,
+    string_view raw_query) const
+{
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+tuple<vector<string_view>, DocumentStatus> ConcurrentSearchServer::Snapshot::MatchDocument(string_view raw_query,
+    int document_id) const
+{
+    const size_t memtable_index = FindMemtableDocument(*version_, document_id);
+    if (memtable_index == version_->memtable.size()) {
+        const size_t segment_index = FindSegment(*version_, document_id);
+        if (segment_index == version_->segments.size()) {
+            throw invalid_argument("no document with such id");
+        }
+        return version_->segments[segment_index].index->MatchDocument(raw_query, document_id);
+    }
+
+    const MemtableDocument& document = *version_->memtable[memtable_index];
+    const SearchServer::Query query = parser_->ParseQuery(raw_query);
+    const auto is_in_document = [&document](string_view word) {
+        return document.CountTerm(word) > 0;
+    };
+    if (any_of(query.minus_words.begin(), query.minus_words.end(), is_in_document)) {
+        return { vector<string_view>{}, document.status };
+    }
+    // Plus-words come out of ParseQuery sorted and unique
+    vector<string_view> matched_words;
+    copy_if(query.plus_words.begin(), query.plus_words.end(), back_inserter(matched_words), is_in_document);
+    return { matched_words, document.status };
+}
+
+int ConcurrentSearchServer::Snapshot::GetDocumentCount() const {
+    return version_->document_count;
+}
+
+size_t ConcurrentSearchServer::Snapshot::GetSegmentCount() const {
+    return version_->segments.size();
+}
+
+SearchServer::Query ConcurrentSearchServer::Snapshot::PrepareQuery(string_view raw_query) const {
+    RECORD_DURATION(GetSearchMetrics().term_lookup);
+    SearchServer::Query query = parser_->ParseQuery(raw_query);
+
+    // Words no live document has are dropped, the way an empty postings
+    // list of a single index contributes nothing
+    SearchServer::Query prepared_query;
+    prepared_query.records_stages = false;
+    prepared_query.minus_words = move(query.minus_words);
+    for (const string_view word : query.plus_words) {
+        size_t document_freq = 0;
+        for (const Segment& segment : version_->segments) {
+            const TermId term_id = segment.index->dictionary_.Find(word);
+            if (term_id == NO_TERM) {
+                continue;
+            }
+            document_freq += segment.index->VisitPostings([&segment, term_id](const auto& postings) {
+                return segment.index->GetDocumentFreq(term_id, postings[term_id].size());
+            });
+            if (segment.tombstones != nullptr) {
+                document_freq -= segment.tombstones->GetDocumentFreq(term_id);
+            }
+        }
+        document_freq += count_if(version_->memtable.begin(), version_->memtable.end(),
+            [word](const shared_ptr<const MemtableDocument>& document) {
+                return document->CountTerm(word) > 0;
+            }
+        );
+        if (document_freq > 0) {
+            prepared_query.plus_words.push_back(word);
+            prepared_query.plus_word_idfs.push_back(log((1.0 * version_->document_count) / document_freq));
+        }
+    }
+    return prepared_query;
+}
+
+uint32_t ConcurrentSearchServer::MemtableDocument::CountTerm(string_view term) const {
+    const auto it = lower_bound(term_counts.begin(), term_counts.end(), term,
+        [](const pair<string_view, uint32_t>& term_count, string_view term) {
+            return term_count.first < term;
+        }
+    );
+    return it != term_counts.end() && it->first == term ? it->second : 0;
+}
+
+size_t ConcurrentSearchServer::Tombstones::size() const {
+    return folded->document_ids.size() + recent_ids.size();
+}
+
+uint32_t ConcurrentSearchServer::Tombstones::GetDocumentFreq(TermId term_id) const {
+    uint32_t document_freq = 0;
+    const auto folded_it = folded->document_freqs.find(term_id);
+    if (folded_it != folded->document_freqs.end()) {
+        document_freq += folded_it->second;
+    }
+    const auto recent_it = lower_bound(recent_document_freqs.begin(), recent_document_freqs.end(),
+        pair{ term_id, uint32_t{ 0 } });
+    if (recent_it != recent_document_freqs.end() && recent_it->first == term_id) {
+        document_freq += recent_it->second;
+    }
+    return document_freq;
+}
+
+unordered_set<int> ConcurrentSearchServer::Tombstones::GetDocumentIds() const {
+    unordered_set<int> document_ids = folded->document_ids;
+    document_ids.insert(recent_ids.begin(), recent_ids.end());
+    return document_ids;
+}
+
+shared_ptr<const ConcurrentSearchServer::Tombstones> ConcurrentSearchServer::Tombstones::Add(
+    const Tombstones* tombstones, const SearchServer& index, vector<int> document_ids)
+{
+    static const Tombstones no_tombstones{ make_shared<const Folded>(), {}, {} };
+    if (tombstones == nullptr) {
+        tombstones = &no_tombstones;
+    }
+    auto added = make_shared<Tombstones>();
+    added->folded = tombstones->folded;
+
+    // Both parts are merged as sorted arrays, so a delete costs as much as
+    // the recent tombstones, not as all of them
+    sort(document_ids.begin(), document_ids.end());
+    added->recent_ids.reserve(tombstones->recent_ids.size() + document_ids.size());
+    merge(tombstones->recent_ids.begin(), tombstones->recent_ids.end(), document_ids.begin(), document_ids.end(),
+        back_inserter(added->recent_ids));
+    vector<pair<TermId, uint32_t>> document_freqs;
+    for (const int document_id : document_ids) {
+        for (const TermCount& term_count : index.documents_[index.document_id_to_ordinal_.at(document_id)].term_counts) {
+            document_freqs.emplace_back(term_count.term_id, 1);
+        }
+    }
+    sort(document_freqs.begin(), document_freqs.end());
+    document_freqs.insert(document_freqs.end(),
+        tombstones->recent_document_freqs.begin(), tombstones->recent_document_freqs.end());
+    inplace_merge(document_freqs.begin(), document_freqs.end() - tombstones->recent_document_freqs.size(),
+        document_freqs.end());
+    for (const auto& [term_id, document_freq] : document_freqs) {
+        if (!added->recent_document_freqs.empty() && added->recent_document_freqs.back().first == term_id) {
+            added->recent_document_freqs.back().second += document_freq;
+        }
+        else {
+            added->recent_document_freqs.emplace_back(term_id, document_freq);
+        }
+    }
+
+    const size_t recent_count = added->recent_ids.size();
+    if (recent_count >= MIN_FOLDED_RECENT_COUNT
+        && recent_count * recent_count >= 16 * added->folded->document_ids.size())
+    {
+        auto folded = make_shared<Folded>(*added->folded);
+        folded->document_ids.insert(added->recent_ids.begin(), added->recent_ids.end());
+        for (const auto& [term_id, document_freq] : added->recent_document_freqs) {
+            folded->document_freqs[term_id] += document_freq;
+        }
+        added->folded = move(folded);
+        added->recent_ids.clear();
+        added->recent_document_freqs.clear();
+    }
+    return added;
+}
+
+ConcurrentSearchServer::ConcurrentSearchServer(const string& stop_words_string, MergePolicy merge_policy)
+    : stop_words_(stop_words_string)
+    , merge_policy_(merge_policy)
+    , parser_(CreateIndex())
+{
+    merge_policy_.memtable_capacity = max(merge_policy_.memtable_capacity, size_t{ 1 });
+    merge_policy_.merge_factor = max(merge_policy_.merge_factor, size_t{ 2 });
+    auto version = make_unique<Version>();
+    current_version_.store(version.get());
+    version_ = move(version);
+    if (merge_policy_.background_merges) {
+        merge_thread_ = thread(&ConcurrentSearchServer::RunMergeThread, this);
+    }
+}
+
+ConcurrentSearchServer::~ConcurrentSearchServer() {
+    {
+        lock_guard lock(merge_thread_mutex_);
+        is_stopping_ = true;
+    }
+    merge_requested_.notify_one();
+    if (merge_thread_.joinable()) {
+        merge_thread_.join();
+    }
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status,
+    const vector<int>& marks)
+{
+    {
+        lock_guard lock(write_mutex_);
+        if (document_id < 0 || Contains(*version_, document_id)) {
+            throw invalid_argument("invalid document id"s);
+        }
+        shared_ptr<const MemtableDocument> memtable_document = CreateMemtableDocument(document_id, document, status,
+            SearchServer::ComputeAverageRating(marks));
+
+        auto version = make_unique<Version>(*version_);
+        version->memtable.push_back(move(memtable_document));
+        ++version->document_count;
+        if (version->memtable.size() < merge_policy_.memtable_capacity) {
+            Publish(move(version));
+            return;
+        }
+        Seal(*version);
+        Publish(move(version));
+    }
+    ScheduleMerges();
+}
+
+void ConcurrentSearchServer::AddDocuments(const vector<NewDocument>& batch) {
+    unique_lock lock(write_mutex_);
+    vector<InvalidBatchError::Rejection> rejections;
+    vector<shared_ptr<const MemtableDocument>> documents;
+    unordered_set<int> batch_ids;
+    for (size_t index = 0; index < batch.size(); ++index) {
+        const NewDocument& document = batch[index];
+        if (document.id < 0 || Contains(*version_, document.id) || !batch_ids.insert(document.id).second) {
+            rejections.push_back({ index, document.id, "invalid document id"s });
+        }
+        try {
+            documents.push_back(CreateMemtableDocument(document.id, document.text, document.status,
+                SearchServer::ComputeAverageRating(document.ratings)));
+        }
+        catch (const invalid_argument& error) {
+            rejections.push_back({ index, document.id, error.what() });
+        }
+    }
+    if (!rejections.empty()) {
+        throw InvalidBatchError(move(rejections));
+    }
+
+    auto version = make_unique<Version>(*version_);
+    move(documents.begin(), documents.end(), back_inserter(version->memtable));
+    version->document_count += static_cast<int>(batch.size());
+    if (version->memtable.size() < merge_policy_.memtable_capacity) {
+        Publish(move(version));
+        return;
+    }
+    Seal(*version);
+    Publish(move(version));
+    lock.unlock();
+    ScheduleMerges();
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    RemoveDocuments({ document_id });
+}
+
+void ConcurrentSearchServer::RemoveDocuments(const vector<int>& document_ids) {
+    unique_lock lock(write_mutex_);
+    auto version = make_unique<Version>(*version_);
+    bool is_changed = false;
+    map<size_t, vector<int>> segment_removals;  // by segment index
+    for (const int document_id : document_ids) {
+        const size_t memtable_index = FindMemtableDocument(*version, document_id);
+        if (memtable_index < version->memtable.size()) {
+            version->memtable.erase(version->memtable.begin() + memtable_index);
+            --version->document_count;
+            is_changed = true;
+            continue;
+        }
+        const size_t segment_index = FindSegment(*version, document_id);
+        if (segment_index < version->segments.size()) {
+            segment_removals[segment_index].push_back(document_id);
+            is_changed = true;
+        }
+    }
+    if (!is_changed) {
+        return;
+    }
+
+    bool is_rewrite_due = false;
+    for (auto& [segment_index, removed_ids] : segment_removals) {
+        // An id given twice is tombstoned once
+        sort(removed_ids.begin(), removed_ids.end());
+        removed_ids.erase(unique(removed_ids.begin(), removed_ids.end()), removed_ids.end());
+        Segment& segment = version->segments[segment_index];
+        segment.document_count -= static_cast<int>(removed_ids.size());
+        version->document_count -= static_cast<int>(removed_ids.size());
+        segment.tombstones = Tombstones::Add(segment.tombstones.get(), *segment.index, move(removed_ids));
+        is_rewrite_due = is_rewrite_due
+            || segment.tombstones->size() > merge_policy_.max_deleted_ratio * segment.index->GetDocumentCount();
+    }
+    Publish(move(version));
+    if (is_rewrite_due) {
+        lock.unlock();
+        ScheduleMerges();
+    }
+}
+
+ConcurrentSearchServer::Snapshot ConcurrentSearchServer::GetSnapshot() const {
+    EpochManager::Guard guard = epochs_.Pin();
+    return Snapshot(move(guard), current_version_.load(), parser_.get());
+}
+
+tuple<vector<string_view>, DocumentStatus> ConcurrentSearchServer::MatchDocument(string_view raw_query,
+    int document_id) const
+{
+    return GetSnapshot().MatchDocument(raw_query, document_id);
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return GetSnapshot().GetDocumentCount();
+}
+
+bool ConcurrentSearchServer::IsLive(const Segment& segment, int document_id) {
+    return segment.index->document_id_to_ordinal_.count(document_id) > 0
+        && (segment.tombstones == nullptr || !segment.tombstones->Contains(document_id));
+}
+
+size_t ConcurrentSearchServer::FindSegment(const Version& version, int document_id) {
+    // A removed and re-added document is live only in the later segment
+    for (size_t i = version.segments.size(); i > 0; --i) {
+        if (IsLive(version.segments[i - 1], document_id)) {
+            return i - 1;
+        }
+    }
+    return version.segments.size();
+}
+
+size_t ConcurrentSearchServer::FindMemtableDocument(const Version& version, int document_id) {
+    return find_if(version.memtable.begin(), version.memtable.end(),
+        [document_id](const shared_ptr<const MemtableDocument>& document) {
+            return document->id == document_id;
+        }
+    ) - version.memtable.begin();
+}
+
+bool ConcurrentSearchServer::Contains(const Version& version, int document_id) {
+    return FindMemtableDocument(version, document_id) < version.memtable.size()
+        || FindSegment(version, document_id) < version.segments.size();
+}
+
+shared_ptr<const ConcurrentSearchServer::MemtableDocument> ConcurrentSearchServer::CreateMemtableDocument(
+    int document_id, string_view document, DocumentStatus status, int rating) const
+{
+    auto memtable_document = make_shared<MemtableDocument>();
+    memtable_document->id = document_id;
+    memtable_document->rating = rating;
+    memtable_document->status = status;
+    memtable_document->text = string(document);
+
+    vector<string_view> words = parser_->SplitIntoWordsNoStop(memtable_document->text);
+    sort(words.begin(), words.end());
+    memtable_document->word_count = static_cast<uint32_t>(words.size());
+    for (const string_view word : words) {
+        vector<pair<string_view, uint32_t>>& term_counts = memtable_document->term_counts;
+        if (term_counts.empty() || term_counts.back().first != word) {
+            term_counts.emplace_back(word, 0);
+        }
+        ++term_counts.back().second;
+    }
+    return memtable_document;
+}
+
+shared_ptr<SearchServer> ConcurrentSearchServer::CreateIndex() const {
+    auto index = make_shared<SearchServer>(stop_words_);
+    index->SetTextStorageMode(TextStorageMode::DISCARD);
+    index->SetPostingsFormat(merge_policy_.postings_format);
+    return index;
+}
+
+void ConcurrentSearchServer::Seal(Version& version) const {
+    vector<NewDocument> batch;
+    batch.reserve(version.memtable.size());
+    for (const shared_ptr<const MemtableDocument>& document : version.memtable) {
+        batch.push_back({ document->id, document->text, document->status, { document->rating } });
+    }
+    shared_ptr<SearchServer> sealed = CreateIndex();
+    sealed->AddDocuments(execution::par, batch);
+    version.segments.push_back({ move(sealed), nullptr, static_cast<int>(batch.size()) });
+    version.memtable.clear();
+}
+
+vector<size_t> ConcurrentSearchServer::PickMerge(const Version& version) const {
+    const vector<Segment>& segments = version.segments;
+    for (size_t position = 0; position < segments.size(); ++position) {
+        const Segment& segment = segments[position];
+        if (segment.tombstones != nullptr && segment.tombstones->size()
+            > merge_policy_.max_deleted_ratio * segment.index->GetDocumentCount()) {
+            return { position };
+        }
+    }
+
+    // Tier t holds segments of memtable_capacity * merge_factor^t live
+    // documents up to merge_factor times that; the lowest full tier goes first
+    map<size_t, vector<size_t>> tiers;
+    for (size_t position = 0; position < segments.size(); ++position) {
+        size_t tier = 0;
+        for (size_t tier_end = merge_policy_.memtable_capacity * merge_policy_.merge_factor;
+            static_cast<size_t>(segments[position].document_count) >= tier_end;
+            tier_end *= merge_policy_.merge_factor) {
+            ++tier;
+        }
+        tiers[tier].push_back(position);
+    }
+    for (const auto& [tier, positions] : tiers) {
+        if (positions.size() >= merge_policy_.merge_factor) {
+            return { positions.begin(), positions.begin() + merge_policy_.merge_factor };
+        }
+    }
+    return {};
+}
+
+shared_ptr<SearchServer> ConcurrentSearchServer::MergeIndexes(const vector<Segment>& inputs) const {
+    static const unordered_set<int> no_ids;
+    shared_ptr<SearchServer> merged = CreateIndex();
+    for (const Segment& input : inputs) {
+        merged->AddDocumentsFrom(*input.index,
+            input.tombstones != nullptr ? input.tombstones->GetDocumentIds() : no_ids);
+    }
+    return merged;
+}
+
+void ConcurrentSearchServer::ReplaceSegments(Version& version, const vector<Segment>& inputs,
+    shared_ptr<const SearchServer> merged)
+{
+    vector<int> removed_ids;
+    size_t position = version.segments.size();
+    for (const Segment& input : inputs) {
+        // Only merges take segments away, and they run one at a time
+        const auto segment_it = find_if(version.segments.begin(), version.segments.end(),
+            [&input](const Segment& segment) { return segment.index == input.index; });
+        if (segment_it->tombstones != nullptr) {
+            for (const int document_id : segment_it->tombstones->GetDocumentIds()) {
+                if (input.tombstones == nullptr || !input.tombstones->Contains(document_id)) {
+                    removed_ids.push_back(document_id);
+                }
+            }
+        }
+        position = min(position, static_cast<size_t>(segment_it - version.segments.begin()));
+        version.segments.erase(segment_it);
+    }
+
+    const int document_count = merged->GetDocumentCount() - static_cast<int>(removed_ids.size());
+    if (document_count > 0) {
+        shared_ptr<const Tombstones> tombstones = removed_ids.empty()
+            ? nullptr : Tombstones::Add(nullptr, *merged, move(removed_ids));
+        version.segments.insert(version.segments.begin() + position, { move(merged), move(tombstones), document_count });
+    }
+}
+
+bool ConcurrentSearchServer::RunMerge() {
+    lock_guard merge_lock(merge_mutex_);
+    vector<Segment> inputs;
+    {
+        lock_guard lock(write_mutex_);
+        for (const size_t position : PickMerge(*version_)) {
+            inputs.push_back(version_->segments[position]);
+        }
+    }
+    if (inputs.empty()) {
+        return false;
+    }
+
+    // Writers go on while the merged index is built
+    shared_ptr<const SearchServer> merged = MergeIndexes(inputs);
+
+    lock_guard lock(write_mutex_);
+    auto version = make_unique<Version>(*version_);
+    ReplaceSegments(*version, inputs, move(merged));
+    Publish(move(version));
+    return true;
+}
+
+void ConcurrentSearchServer::RunPendingMerges() {
+    while (RunMerge()) {
+    }
+}
+
+void ConcurrentSearchServer::RunMergeThread() {
+    unique_lock lock(merge_thread_mutex_);
+    while (true) {
+        merge_requested_.wait(lock, [this] { return has_merge_request_ || is_stopping_; });
+        if (is_stopping_) {
+            return;
+        }
+        has_merge_request_ = false;
+        lock.unlock();
+        while (!is_stopping_ && RunMerge()) {
+        }
+        lock.lock();
+    }
+}
+
+void ConcurrentSearchServer::ScheduleMerges() {
+    if (!merge_policy_.background_merges) {
+        RunPendingMerges();
+        return;
+    }
+    {
+        lock_guard lock(merge_thread_mutex_);
+        has_merge_request_ = true;
+    }
+    merge_requested_.notify_one();
+}
+
+void ConcurrentSearchServer::Publish(unique_ptr<Version> version) {
+    current_version_.store(version.get());
+    shared_ptr<const void> previous = move(version_);
+    version_ = move(version);
+    epochs_.Retire(move(previous));
+}
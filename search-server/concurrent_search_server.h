@@ -0,0 +1,327 @@
+#pragma once
+#include "document.h"
+#include "epoch_manager.h"
+#include "search_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <execution>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// How a ConcurrentSearchServer trades write cost for read cost. A bigger
+// memtable means fewer, larger sealed segments but a longer list every write
+// copies and every query scans; a bigger merge factor means less merging
+// but more segments per query.
+struct MergePolicy {
+    size_t memtable_capacity = 256;  // documents
+    // Segments whose sizes are within a factor of merge_factor of each other
+    // form a tier; a tier that gathers merge_factor segments is merged into one
+    size_t merge_factor = 4;
+    // A segment with a larger share of tombstoned documents is rewritten
+    double max_deleted_ratio = 0.25;
+    // Postings format of sealed segments
+    PostingsFormat postings_format = PostingsFormat::PLAIN;
+    // Merges run on a thread of the server's own rather than in the writer
+    // that sealed the memtable
+    bool background_merges = true;
+};
+
+// Search index that can be updated while other threads query it. New
+// documents go to a memtable, a short list of tokenized documents that
+// queries scan in full. Once the memtable reaches its capacity it is sealed
+// into an immutable segment, a SearchServer of its own. Sealed segments are
+// merged in size tiers by a background thread, so a query visits a number
+// of segments logarithmic in the size of the index. Removing a sealed
+// document only records a tombstone; merges drop the tombstoned documents.
+//
+// Every write publishes a new version, a list of segments sharing all the
+// unchanged ones with the previous version. Readers pin the current version
+// through an EpochManager, without taking a lock, and see it unchanged for as
+// long as they hold it; a replaced version is destroyed once the last reader
+// pinned to it is gone. Writers are serialized among themselves and never
+// wait for readers.
+//
+// IDFs are computed over the whole version, tombstoned documents excluded,
+// so queries rank exactly as one SearchServer holding the same documents.
+// Document texts are not kept.
+class ConcurrentSearchServer {
+    struct Segment;
+    struct Version;
+
+public:
+
+    // Consistent read-only view of the index as of the moment it was taken
+    class Snapshot {
+    public:
+        template <typename Predicate>
+        std::vector<Document> FindTopDocuments(std::string_view raw_query, Predicate predicate,
+            size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+        std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus doc_status,
+            size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+        std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+        template <typename Predicate>
+        std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query,
+            Predicate predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+        std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query,
+            DocumentStatus doc_status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+        std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query) const;
+
+        std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+            int document_id) const;
+
+        int GetDocumentCount() const;
+
+        // Sealed segments only
+        size_t GetSegmentCount() const;
+
+    private:
+        friend class ConcurrentSearchServer;
+
+        Snapshot(EpochManager::Guard guard, const Version* version, const SearchServer* parser);
+
+        // The query with the plus-words no live document has dropped and the
+        // IDFs of the whole version filled in
+        SearchServer::Query PrepareQuery(std::string_view raw_query) const;
+
+        template <typename Predicate>
+        void FindMemtableDocuments(const SearchServer::Query& query, Predicate& predicate,
+            TopDocumentsCollector& top_documents) const;
+
+        EpochManager::Guard guard_;
+        const Version* version_;
+        const SearchServer* parser_;
+    };
+
+    // Snapshots must not outlive the server.
+    explicit ConcurrentSearchServer(const std::string& stop_words_string, MergePolicy merge_policy = {});
+    ConcurrentSearchServer(const ConcurrentSearchServer&) = delete;
+    ConcurrentSearchServer& operator=(const ConcurrentSearchServer&) = delete;
+    ~ConcurrentSearchServer();
+
+    // Same rules as the SearchServer methods of the same names. Each call
+    // publishes a new version once the change is complete.
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& marks);
+    void AddDocuments(const std::vector<NewDocument>& batch);
+    void RemoveDocument(int document_id);
+    // Unknown ids are skipped. Publishes one version and copies the
+    // tombstones of each segment it touches once, whatever the batch size.
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    // Never blocks, whatever the writers are doing
+    Snapshot GetSnapshot() const;
+
+    // Shorthands for taking a snapshot for the duration of one call
+    template <typename... Args>
+    std::vector<Document> FindTopDocuments(Args&&... args) const {
+        return GetSnapshot().FindTopDocuments(std::forward<Args>(args)...);
+    }
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+    int GetDocumentCount() const;
+
+    // Runs in the calling thread every merge the policy asks for, including
+    // the ones the background thread has not got to yet.
+    void RunPendingMerges();
+
+private:
+    // Document as the memtable keeps it, term_counts viewing text
+    struct MemtableDocument {
+        int id;
+        int rating;
+        DocumentStatus status;
+        std::string text;
+        uint32_t word_count;  // without stop words
+        std::vector<std::pair<std::string_view, uint32_t>> term_counts;  // sorted by term
+
+        // Times term occurs in the document
+        uint32_t CountTerm(std::string_view term) const;
+    };
+
+    // Documents removed from a sealed segment that it still holds. The ones
+    // removed lately sit in sorted arrays that every delete copies; once they
+    // outnumber a few times the square root of the older ones, they are folded
+    // into hash tables that later versions share. Deleting k documents from a
+    // segment one by one thus copies O(k sqrt k) entries rather than O(k^2).
+    struct Tombstones {
+        struct Folded {
+            std::unordered_set<int> document_ids;
+            std::unordered_map<TermId, uint32_t> document_freqs;  // by term id of the segment
+        };
+        static const size_t MIN_FOLDED_RECENT_COUNT = 64;
+
+        std::shared_ptr<const Folded> folded;  // never nullptr
+        std::vector<int> recent_ids;  // sorted
+        std::vector<std::pair<TermId, uint32_t>> recent_document_freqs;  // sorted by term id
+
+        bool Contains(int document_id) const {
+            return folded->document_ids.count(document_id) > 0
+                || std::binary_search(recent_ids.begin(), recent_ids.end(), document_id);
+        }
+        size_t size() const;
+        // Tombstoned documents with the term
+        uint32_t GetDocumentFreq(TermId term_id) const;
+        std::unordered_set<int> GetDocumentIds() const;
+
+        // tombstones, which may be nullptr, with the documents of index added;
+        // none of them may be tombstoned already
+        static std::shared_ptr<const Tombstones> Add(const Tombstones* tombstones, const SearchServer& index,
+            std::vector<int> document_ids);
+    };
+
+    struct Segment {
+        std::shared_ptr<const SearchServer> index;
+        std::shared_ptr<const Tombstones> tombstones;  // nullptr while there are none
+        int document_count = 0;  // tombstones excluded
+    };
+
+    struct Version {
+        std::vector<Segment> segments;  // oldest first
+        // Copied by every write, which is why the memtable is kept short
+        std::vector<std::shared_ptr<const MemtableDocument>> memtable;
+        int document_count = 0;
+    };
+
+    static bool IsLive(const Segment& segment, int document_id);
+    // Index of the sealed segment with a live document_id, segments.size() if none
+    static size_t FindSegment(const Version& version, int document_id);
+    // Index in the memtable, memtable.size() if the document is not there
+    static size_t FindMemtableDocument(const Version& version, int document_id);
+    static bool Contains(const Version& version, int document_id);
+
+    // Tokenized the way a SearchServer would. Throws std::invalid_argument
+    // for the words a SearchServer rejects.
+    std::shared_ptr<const MemtableDocument> CreateMemtableDocument(int document_id, std::string_view document,
+        DocumentStatus status, int rating) const;
+
+    // Empty segment index with the server's stop words and settings
+    std::shared_ptr<SearchServer> CreateIndex() const;
+
+    // Turns a full memtable into a sealed segment
+    void Seal(Version& version) const;
+
+    // Positions of the segments to merge next, empty if there is nothing to
+    // do. A single segment is to be rewritten without its tombstones.
+    std::vector<size_t> PickMerge(const Version& version) const;
+    // Live documents of the segments as of the tombstones they carry
+    std::shared_ptr<SearchServer> MergeIndexes(const std::vector<Segment>& inputs) const;
+    // Puts merged in place of inputs, carrying over the tombstones the
+    // inputs got while merged was being built
+    static void ReplaceSegments(Version& version, const std::vector<Segment>& inputs,
+        std::shared_ptr<const SearchServer> merged);
+    // Performs one merge against the current version. Returns false if
+    // there was nothing to merge.
+    bool RunMerge();
+    void RunMergeThread();
+    // Hands merges to the background thread or runs them right away
+    void ScheduleMerges();
+
+    // Makes version the current one and retires the previous one
+    void Publish(std::unique_ptr<Version> version);
+
+    std::string stop_words_;
+    MergePolicy merge_policy_;
+    // Empty index that tokenizes documents and parses queries
+    std::shared_ptr<const SearchServer> parser_;
+
+    std::mutex write_mutex_;
+    std::unique_ptr<const Version> version_;  // owned by the writers
+    std::atomic<const Version*> current_version_{ nullptr };  // what readers pin
+    mutable EpochManager epochs_;
+
+    std::mutex merge_mutex_;  // one merge at a time
+    std::mutex merge_thread_mutex_;
+    std::condition_variable merge_requested_;
+    bool has_merge_request_ = false;
+    std::atomic<bool> is_stopping_{ false };
+    std::thread merge_thread_;
+};
+
+template <typename Predicate>
+std::vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(std::string_view raw_query,
+    Predicate predicate, size_t max_result_count) const
+{
+    GetSearchMetrics().queries.Add();
+    const SearchServer::Query query = PrepareQuery(raw_query);
+    TopDocumentsCollector top_documents(max_result_count);
+    {
+        // Every segment and the memtable are scored as one sample, the segments'
+        // own lookups and top-K selection included
+        RECORD_DURATION(GetSearchMetrics().postings_scan);
+        for (const Segment& segment : version_->segments) {
+            const Tombstones* tombstones = segment.tombstones.get();
+            const auto is_wanted = [tombstones, &predicate](int document_id, DocumentStatus status, int rating) {
+                return (tombstones == nullptr || !tombstones->Contains(document_id))
+                    && predicate(document_id, status, rating);
+            };
+            for (const Document& document : segment.index->FindTopDocumentsForQuery(query, is_wanted, max_result_count)) {
+                top_documents.Offer(document);
+            }
+        }
+        FindMemtableDocuments(query, predicate, top_documents);
+    }
+    RECORD_DURATION(GetSearchMetrics().top_k);
+    return top_documents.Extract();
+}
+
+template <typename Predicate>
+std::vector<Document> ConcurrentSearchServer::Snapshot::FindTopDocuments(std::execution::parallel_policy policy,
+    std::string_view raw_query, Predicate predicate, size_t max_result_count) const
+{
+    GetSearchMetrics().queries.Add();
+    const SearchServer::Query query = PrepareQuery(raw_query);
+    TopDocumentsCollector top_documents(max_result_count);
+    {
+        // Every segment and the memtable are scored as one sample, the segments'
+        // own lookups and top-K selection included
+        RECORD_DURATION(GetSearchMetrics().postings_scan);
+        for (const Segment& segment : version_->segments) {
+            const Tombstones* tombstones = segment.tombstones.get();
+            const auto is_wanted = [tombstones, &predicate](int document_id, DocumentStatus status, int rating) {
+                return (tombstones == nullptr || !tombstones->Contains(document_id))
+                    && predicate(document_id, status, rating);
+            };
+            for (const Document& document : segment.index->FindTopDocumentsForQuery(policy, query, is_wanted,
+                max_result_count)) {
+                top_documents.Offer(document);
+            }
+        }
+        FindMemtableDocuments(query, predicate, top_documents);
+    }
+    RECORD_DURATION(GetSearchMetrics().top_k);
+    return top_documents.Extract();
+}
+
+// Relevances are summed in plus-word order, as SearchServer sums them
+template <typename Predicate>
+void ConcurrentSearchServer::Snapshot::FindMemtableDocuments(const SearchServer::Query& query, Predicate& predicate,
+    TopDocumentsCollector& top_documents) const
+{
+    for (const std::shared_ptr<const MemtableDocument>& document : version_->memtable) {
+        bool is_matched = false;
+        double relevance = 0.0;
+        for (size_t i = 0; i < query.plus_words.size(); ++i) {
+            if (const uint32_t term_count = document->CountTerm(query.plus_words[i])) {
+                is_matched = true;
+                relevance += ComputeTermFreq(term_count, document->word_count) * query.plus_word_idfs[i];
+            }
+        }
+        if (!is_matched
+            || std::any_of(query.minus_words.begin(), query.minus_words.end(),
+                [&document](std::string_view word) { return document->CountTerm(word) > 0; })
+            || !predicate(document->id, document->status, document->rating)) {
+            continue;
+        }
+        top_documents.Offer({ document->id, relevance, document->rating });
+    }
+}
@@ -1,6 +1,15 @@
 #pragma once
+#include "flat_array.h"
+#include "term_dictionary.h"
+
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+const double EPSILON = 1e-6;  // relevances closer than this are considered equal
 
 enum class DocumentStatus {
     ACTUAL,
@@ -18,10 +27,29 @@ struct Document {
     int rating;
 };
 
+// One document of a SearchServer::AddDocuments batch. The text only has to
+// stay alive during the call.
+struct NewDocument {
+    int id;
+    std::string_view text;
+    DocumentStatus status;
+    std::vector<int> ratings;
+};
+
+struct TermCount {
+    TermId term_id;
+    uint32_t count;
+};
+
 struct DocumentData {
+    int id;
     int rating;
     DocumentStatus status;
-    std::string doc_text;
+    uint32_t word_count;  // without stop words
+    FlatArray<TermCount> term_counts;  // forward index, sorted by term id
+    // Tombstone: the document is removed but still in the postings until
+    // they are swept
+    bool is_removed = false;
 };
 
 std::ostream& operator<<(std::ostream& os, const Document& document);
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "document_text_storage.h"
+
+#include <utility>
+
+using namespace std;
+
+DocumentTextStorage::DocumentTextStorage()
+    : arena_(BLOCK_SIZE)
+{
+}
+
+void DocumentTextStorage::Store(uint32_t ordinal, string_view text) {
+    if (texts_.size() <= ordinal) {
+        texts_.resize(ordinal + 1);
+    }
+    Release(ordinal);
+    texts_[ordinal] = arena_.Copy(text);
+    live_bytes_ += text.size();
+}
+
+void DocumentTextStorage::StoreBorrowed(uint32_t ordinal, string_view text) {
+    if (texts_.size() <= ordinal) {
+        texts_.resize(ordinal + 1);
+    }
+    Release(ordinal);
+    texts_[ordinal] = text;
+    live_bytes_ += text.size();
+}
+
+string_view DocumentTextStorage::Get(uint32_t ordinal) const {
+    return ordinal < texts_.size() ? texts_[ordinal] : string_view();
+}
+
+void DocumentTextStorage::Release(uint32_t ordinal) {
+    if (ordinal >= texts_.size() || texts_[ordinal].empty()) {
+        return;
+    }
+    live_bytes_ -= texts_[ordinal].size();
+    garbage_bytes_ += texts_[ordinal].size();
+    texts_[ordinal] = {};
+    if (garbage_bytes_ >= BLOCK_SIZE && garbage_bytes_ > live_bytes_) {
+        Compact();
+    }
+}
+
+void DocumentTextStorage::ReleaseAll() {
+    texts_.assign(texts_.size(), string_view());
+    live_bytes_ = 0;
+    Compact();
+}
+
+void DocumentTextStorage::EraseAndRenumber(const vector<uint32_t>& erased_ordinals) {
+    for (const uint32_t ordinal : erased_ordinals) {
+        Release(ordinal);
+    }
+    auto erased_it = erased_ordinals.begin();
+    size_t kept_count = 0;
+    for (uint32_t ordinal = 0; ordinal < texts_.size(); ++ordinal) {
+        if (erased_it != erased_ordinals.end() && *erased_it == ordinal) {
+            ++erased_it;
+            continue;
+        }
+        texts_[kept_count++] = texts_[ordinal];
+    }
+    texts_.resize(kept_count);
+}
+
+void DocumentTextStorage::Compact() {
+    StringArena compacted(BLOCK_SIZE);
+    for (string_view& text : texts_) {
+        text = compacted.Copy(text);
+    }
+    arena_ = move(compacted);
+    garbage_bytes_ = 0;
+}
+
+size_t DocumentTextStorage::GetLiveBytes() const {
+    return live_bytes_;
+}
+
+size_t DocumentTextStorage::GetAllocatedBytes() const {
+    return arena_.GetAllocatedBytes();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "string_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Document bodies indexed by document ordinal and packed into a StringArena
+// instead of one heap string per document. Releasing a text only leaves
+// garbage behind; once the garbage outgrows the live texts, the live ones are
+// copied into a fresh arena and the old blocks are freed, so removals cost
+// amortized O(1) per byte. Views returned by Get are invalidated by
+// compaction, which Release may trigger.
+class DocumentTextStorage {
+public:
+    DocumentTextStorage();
+
+    // Stores text under ordinal, releasing whatever was stored there before.
+    void Store(uint32_t ordinal, std::string_view text);
+    // Keeps a view of text instead of a copy, so the text must outlive the
+    // storage. Meant for texts in a mapped snapshot.
+    void StoreBorrowed(uint32_t ordinal, std::string_view text);
+
+    // Empty for ordinals that have no text stored.
+    std::string_view Get(uint32_t ordinal) const;
+
+    void Release(uint32_t ordinal);
+    void ReleaseAll();
+    // Releases the texts of ordinals, sorted ascending, and moves the later
+    // texts down over them, following documents renumbered densely.
+    void EraseAndRenumber(const std::vector<uint32_t>& ordinals);
+
+    void Compact();
+
+    size_t GetLiveBytes() const;
+    size_t GetAllocatedBytes() const;
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    StringArena arena_;
+    std::vector<std::string_view> texts_;  // indexed by document ordinal
+    size_t live_bytes_ = 0;
+    size_t garbage_bytes_ = 0;
+};
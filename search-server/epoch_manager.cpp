@@ -0,0 +1,88 @@
+#include "epoch_manager.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+using namespace std;
+
+EpochManager::Guard::Guard(atomic<uint64_t>* slot)
+    : slot_(slot)
+{
+}
+
+EpochManager::Guard::Guard(Guard&& other) noexcept
+    : slot_(exchange(other.slot_, nullptr))
+{
+}
+
+EpochManager::Guard& EpochManager::Guard::operator=(Guard&& other) noexcept {
+    if (this != &other) {
+        if (slot_ != nullptr) {
+            slot_->store(0);
+        }
+        slot_ = exchange(other.slot_, nullptr);
+    }
+    return *this;
+}
+
+EpochManager::Guard::~Guard() {
+    if (slot_ != nullptr) {
+        slot_->store(0);
+    }
+}
+
+EpochManager::Guard EpochManager::Pin() {
+    // Threads start probing at different slots, so they rarely contend
+    size_t slot_index = hash<thread::id>{}(this_thread::get_id()) % SLOT_COUNT;
+    while (true) {
+        // Announcing the epoch read before the slot is claimed is safe: an
+        // object retired in between is only freed by a writer that saw the
+        // slot empty, and such a writer had unpublished it before the reader
+        // got to load anything
+        uint64_t free_slot = 0;
+        if (slots_[slot_index].epoch.compare_exchange_strong(free_slot, epoch_.load())) {
+            return Guard(&slots_[slot_index].epoch);
+        }
+        slot_index = (slot_index + 1) % SLOT_COUNT;
+    }
+}
+
+void EpochManager::Retire(shared_ptr<const void> object) {
+    {
+        lock_guard lock(retired_mutex_);
+        retired_.emplace_back(epoch_.fetch_add(1), move(object));
+    }
+    Reclaim();
+}
+
+void EpochManager::Reclaim() {
+    vector<shared_ptr<const void>> unreachable;
+    {
+        lock_guard lock(retired_mutex_);
+        uint64_t min_pinned_epoch = numeric_limits<uint64_t>::max();
+        for (const Slot& slot : slots_) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch != 0) {
+                min_pinned_epoch = min(min_pinned_epoch, epoch);
+            }
+        }
+        // A reader pinned at epoch e may hold objects retired at e or later
+        const auto reachable_begin = stable_partition(retired_.begin(), retired_.end(),
+            [min_pinned_epoch](const pair<uint64_t, shared_ptr<const void>>& retired) {
+                return retired.first < min_pinned_epoch;
+            }
+        );
+        for (auto it = retired_.begin(); it != reachable_begin; ++it) {
+            unreachable.push_back(move(it->second));
+        }
+        retired_.erase(retired_.begin(), reachable_begin);
+    }
+    // Destroyed outside the lock, objects may be large
+}
+
+size_t EpochManager::GetRetiredCount() const {
+    lock_guard lock(retired_mutex_);
+    return retired_.size();
+}
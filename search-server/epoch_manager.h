@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation of objects that readers use without locks. A
+// reader pins the current epoch into one of a fixed set of slots for as long
+// as it holds pointers to shared objects. A writer that has replaced such an
+// object retires it, and the object is destroyed once every reader that was
+// pinned when it was retired has unpinned. Pinning costs one compare-and-swap
+// on a cache line no other thread uses unless more than SLOT_COUNT readers
+// are pinned at once.
+class EpochManager {
+public:
+    static const size_t SLOT_COUNT = 128;
+
+    // Pins the epoch for its lifetime
+    class Guard {
+    public:
+        Guard() = default;
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard(Guard&& other) noexcept;
+        Guard& operator=(Guard&& other) noexcept;
+        ~Guard();
+
+    private:
+        friend class EpochManager;
+
+        explicit Guard(std::atomic<uint64_t>* slot);
+
+        std::atomic<uint64_t>* slot_ = nullptr;
+    };
+
+    EpochManager() = default;
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Objects published before the call stay alive until the guard is gone.
+    // Never blocks; spins only while all the slots are taken.
+    Guard Pin();
+
+    // Takes over an object no new reader can reach any more and destroys it
+    // once the readers that still might have are gone. Also destroys whatever
+    // earlier retired objects have become unreachable.
+    void Retire(std::shared_ptr<const void> object);
+
+    // Destroys the retired objects no pinned reader can reach.
+    void Reclaim();
+
+    // Retired objects still waiting for readers
+    size_t GetRetiredCount() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{ 0 };  // 0 while no reader holds the slot
+    };
+
+    std::array<Slot, SLOT_COUNT> slots_;
+    std::atomic<uint64_t> epoch_{ 1 };
+
+    mutable std::mutex retired_mutex_;
+    std::vector<std::pair<uint64_t, std::shared_ptr<const void>>> retired_;  // {epoch of retirement, object}
+};
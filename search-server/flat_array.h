@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Contiguous array of trivially copyable elements that either owns them or
+// borrows read-only ones kept alive by someone else, typically a memory-mapped
+// snapshot. A borrowed array is copied into storage of its own on the first
+// call to Mutable, so index data loaded from a snapshot is only ever copied
+// for the parts that change.
+template <typename T>
+class FlatArray {
+    static_assert(std::is_trivially_copyable_v<T>, "FlatArray elements must be trivially copyable");
+
+public:
+    FlatArray() = default;
+
+    explicit FlatArray(std::vector<T> elements)
+        : owned_(std::move(elements))
+    {
+    }
+
+    // The elements must stay valid and unchanged for as long as the array
+    // borrows them.
+    static FlatArray Borrow(const T* data, size_t size) {
+        FlatArray array;
+        if (size > 0) {
+            array.borrowed_ = data;
+            array.borrowed_size_ = size;
+        }
+        return array;
+    }
+
+    const T* data() const {
+        return borrowed_ != nullptr ? borrowed_ : owned_.data();
+    }
+
+    size_t size() const {
+        return borrowed_ != nullptr ? borrowed_size_ : owned_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    const T& back() const {
+        return data()[size() - 1];
+    }
+
+    bool IsBorrowed() const {
+        return borrowed_ != nullptr;
+    }
+
+    std::vector<T>& Mutable() {
+        if (borrowed_ != nullptr) {
+            owned_.assign(borrowed_, borrowed_ + borrowed_size_);
+            borrowed_ = nullptr;
+            borrowed_size_ = 0;
+        }
+        return owned_;
+    }
+
+private:
+    const T* borrowed_ = nullptr;
+    size_t borrowed_size_ = 0;
+    std::vector<T> owned_;
+};
@@ -0,0 +1,94 @@
+#include "generators.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+string GenerateWord(mt19937& generator, int max_length) {
+    const int length = uniform_int_distribution(1, max_length)(generator);
+    string word;
+    word.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        word.push_back(uniform_int_distribution(97, 122)(generator));
+    }
+    return word;
+}
+
+vector<string> GenerateDictionary(mt19937& generator, int word_count, int max_length) {
+    vector<string> words;
+    words.reserve(word_count);
+    for (int i = 0; i < word_count; ++i) {
+        words.push_back(GenerateWord(generator, max_length));
+    }
+    words.erase(unique(words.begin(), words.end()), words.end());
+    return words;
+}
+
+string GenerateQuery(mt19937& generator, const vector<string>& dictionary, int word_count, double minus_prob) {
+    string query;
+    for (int i = 0; i < word_count; ++i) {
+        if (!query.empty()) {
+            query.push_back(' ');
+        }
+        if (uniform_real_distribution<>(0, 1)(generator) < minus_prob) {
+            query.push_back('-');
+        }
+        query += dictionary[uniform_int_distribution<int>(0, dictionary.size() - 1)(generator)];
+    }
+    return query;
+}
+
+vector<string> GenerateQueries(mt19937& generator, const vector<string>& dictionary, int query_count, int max_word_count) {
+    vector<string> queries;
+    queries.reserve(query_count);
+    for (int i = 0; i < query_count; ++i) {
+        queries.push_back(GenerateQuery(generator, dictionary, max_word_count));
+    }
+    return queries;
+}
+
+ZipfianDistribution::ZipfianDistribution(size_t n, double s) {
+    cdf_.reserve(n);
+    double sum = 0.0;
+    for (size_t rank = 0; rank < n; ++rank) {
+        sum += 1.0 / pow(static_cast<double>(rank + 1), s);
+        cdf_.push_back(sum);
+    }
+    for (double& probability : cdf_) {
+        probability /= sum;
+    }
+}
+
+size_t ZipfianDistribution::operator()(mt19937& generator) const {
+    const double value = uniform_real_distribution<>(0, 1)(generator);
+    const auto rank_it = lower_bound(cdf_.begin(), cdf_.end(), value);
+    return min(static_cast<size_t>(rank_it - cdf_.begin()), cdf_.size() - 1);
+}
+
+string GenerateZipfianQuery(mt19937& generator, const vector<string>& dictionary,
+    const ZipfianDistribution& distribution, int word_count, double minus_prob)
+{
+    string query;
+    for (int i = 0; i < word_count; ++i) {
+        if (!query.empty()) {
+            query.push_back(' ');
+        }
+        if (uniform_real_distribution<>(0, 1)(generator) < minus_prob) {
+            query.push_back('-');
+        }
+        query += dictionary[distribution(generator)];
+    }
+    return query;
+}
+
+vector<string> GenerateZipfianQueries(mt19937& generator, const vector<string>& dictionary,
+    const ZipfianDistribution& distribution, int query_count, int word_count, double minus_prob)
+{
+    vector<string> queries;
+    queries.reserve(query_count);
+    for (int i = 0; i < query_count; ++i) {
+        queries.push_back(GenerateZipfianQuery(generator, dictionary, distribution, word_count, minus_prob));
+    }
+    return queries;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+// Random words, documents and queries for main.cpp and the benchmark
+
+std::string GenerateWord(std::mt19937& generator, int max_length);
+
+std::vector<std::string> GenerateDictionary(std::mt19937& generator, int word_count, int max_length);
+
+std::string GenerateQuery(std::mt19937& generator, const std::vector<std::string>& dictionary, int word_count,
+    double minus_prob = 0);
+
+std::vector<std::string> GenerateQueries(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    int query_count, int max_word_count);
+
+// Ranks in [0, n) drawn with probability proportional to 1 / (rank + 1)^s,
+// the way word frequencies fall off in natural text. s = 0 is uniform.
+// Sampling is a binary search over the precomputed CDF.
+class ZipfianDistribution {
+public:
+    ZipfianDistribution(size_t n, double s);
+
+    size_t operator()(std::mt19937& generator) const;
+
+private:
+    std::vector<double> cdf_;
+};
+
+// Like GenerateQuery, with words drawn from dictionary by rank
+std::string GenerateZipfianQuery(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    const ZipfianDistribution& distribution, int word_count, double minus_prob = 0);
+
+std::vector<std::string> GenerateZipfianQueries(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    const ZipfianDistribution& distribution, int query_count, int word_count, double minus_prob = 0);
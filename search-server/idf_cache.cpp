@@ -0,0 +1,10 @@
+#include "idf_cache.h"
+
+using namespace std;
+
+void IdfCache::Reset(size_t term_count) {
+    ++generation_;
+    while (entries_.size() < term_count) {
+        entries_.emplace_back();
+    }
+}
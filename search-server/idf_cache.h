@@ -0,0 +1,41 @@
+#pragma once
+#include "term_dictionary.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+// IDFs by term id, each computed on first use after the last change to the
+// index and reused by every query until the next one, so the query loop
+// takes no logarithms for terms seen before. Lookups from many threads at
+// once are safe as long as the index doesn't change meanwhile, which is how
+// SearchServer queries run: racing lookups of one term compute the same
+// value and store it twice.
+class IdfCache {
+public:
+    // Forgets every IDF, in O(1) plus the room made for new term ids
+    void Reset(size_t term_count);
+
+    // compute() gives the IDF of term_id if it's not known since the last Reset
+    template <typename Compute>
+    double Get(TermId term_id, Compute compute) const {
+        Entry& entry = entries_[term_id];
+        if (entry.generation.load(std::memory_order_acquire) == generation_) {
+            return entry.idf.load(std::memory_order_relaxed);
+        }
+        const double idf = compute();
+        entry.idf.store(idf, std::memory_order_relaxed);
+        entry.generation.store(generation_, std::memory_order_release);
+        return idf;
+    }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> generation{ 0 };
+        std::atomic<double> idf{ 0.0 };
+    };
+
+    mutable std::deque<Entry> entries_;  // a deque, as atomics can't be moved
+    uint64_t generation_ = 1;
+};
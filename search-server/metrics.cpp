@@ -0,0 +1,300 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+size_t LatencyHistogram::GetBucket(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(value);
+    }
+    // Position of the highest set bit, by halving
+    int exponent = 0;
+    for (uint64_t high_bits = value, shift = 32; shift > 0; shift /= 2) {
+        if ((high_bits >> shift) != 0) {
+            high_bits >>= shift;
+            exponent += static_cast<int>(shift);
+        }
+    }
+    const size_t sub_bucket = static_cast<size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+    return static_cast<size_t>(exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub_bucket;
+}
+
+uint64_t LatencyHistogram::GetBucketStart(size_t bucket) {
+    if (bucket < SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    const int shift = static_cast<int>(bucket / SUB_BUCKET_COUNT) - 1;
+    return (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+    ++buckets_[GetBucket(value)];
+    ++count_;
+    sum_ += value;
+}
+
+void LatencyHistogram::Add(const LatencyHistogram& other) {
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        buckets_[bucket] += other.buckets_[bucket];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+}
+
+void LatencyHistogram::Subtract(const LatencyHistogram& other) {
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        buckets_[bucket] -= other.buckets_[bucket];
+    }
+    count_ -= other.count_;
+    sum_ -= other.sum_;
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+    return count_;
+}
+
+uint64_t LatencyHistogram::GetSum() const {
+    return sum_;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double fraction) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    const uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(fraction * count_ + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        seen += buckets_[bucket];
+        if (seen >= rank) {
+            const uint64_t start = GetBucketStart(bucket);
+            const uint64_t width = bucket < SUB_BUCKET_COUNT ? 1 : GetBucketStart(bucket + 1) - start;
+            return start + width / 2;
+        }
+    }
+    return GetMax();
+}
+
+uint64_t LatencyHistogram::GetMax() const {
+    for (size_t bucket = BUCKET_COUNT; bucket > 0; --bucket) {
+        if (buckets_[bucket - 1] > 0) {
+            return bucket < BUCKET_COUNT ? GetBucketStart(bucket) - 1 : numeric_limits<uint64_t>::max();
+        }
+    }
+    return 0;
+}
+
+LatencyMetric::LatencyMetric(string name)
+    : index_(MetricsRegistry::Get().RegisterLatency(move(name)))
+{}
+
+void LatencyMetric::Record(chrono::nanoseconds duration) const {
+    MetricsRegistry::Get().RecordLatency(index_, static_cast<uint64_t>(max<int64_t>(0, duration.count())));
+}
+
+CounterMetric::CounterMetric(string name)
+    : index_(MetricsRegistry::Get().RegisterCounter(move(name)))
+{}
+
+void CounterMetric::Add(uint64_t value) const {
+    MetricsRegistry& registry = MetricsRegistry::Get();
+    if (registry.IsEnabled()) {
+        registry.AddToCounter(index_, value);
+    }
+}
+
+MetricsSnapshot MetricsSnapshot::Since(const MetricsSnapshot& earlier) const {
+    MetricsSnapshot difference = *this;
+    // Metrics registered after earlier was taken have nothing to subtract
+    for (size_t i = 0; i < earlier.latencies.size(); ++i) {
+        difference.latencies[i].histogram.Subtract(earlier.latencies[i].histogram);
+    }
+    for (size_t i = 0; i < earlier.counters.size(); ++i) {
+        difference.counters[i].value -= earlier.counters[i].value;
+    }
+    return difference;
+}
+
+string MetricsSnapshot::ToText() const {
+    ostringstream text;
+    for (const Latency& latency : latencies) {
+        const LatencyHistogram& histogram = latency.histogram;
+        text << latency.name << ": count " << histogram.GetCount()
+            << ", mean " << (histogram.GetCount() > 0 ? histogram.GetSum() / histogram.GetCount() : 0)
+            << " ns, p50 " << histogram.GetPercentile(0.5)
+            << " ns, p90 " << histogram.GetPercentile(0.9)
+            << " ns, p99 " << histogram.GetPercentile(0.99)
+            << " ns, p99.9 " << histogram.GetPercentile(0.999)
+            << " ns, max " << histogram.GetMax() << " ns\n";
+    }
+    for (const Counter& counter : counters) {
+        text << counter.name << ": " << counter.value << '\n';
+    }
+    return text.str();
+}
+
+// Metric names are identifiers the program chose, so they need no escaping
+string MetricsSnapshot::ToJson() const {
+    ostringstream json;
+    json << "{\"latencies\": {";
+    for (size_t i = 0; i < latencies.size(); ++i) {
+        const LatencyHistogram& histogram = latencies[i].histogram;
+        json << (i > 0 ? ", " : "") << '"' << latencies[i].name << "\": {"
+            << "\"count\": " << histogram.GetCount()
+            << ", \"sum_ns\": " << histogram.GetSum()
+            << ", \"p50_ns\": " << histogram.GetPercentile(0.5)
+            << ", \"p90_ns\": " << histogram.GetPercentile(0.9)
+            << ", \"p99_ns\": " << histogram.GetPercentile(0.99)
+            << ", \"p999_ns\": " << histogram.GetPercentile(0.999)
+            << ", \"max_ns\": " << histogram.GetMax() << '}';
+    }
+    json << "}, \"counters\": {";
+    for (size_t i = 0; i < counters.size(); ++i) {
+        json << (i > 0 ? ", " : "") << '"' << counters[i].name << "\": " << counters[i].value;
+    }
+    json << "}}";
+    return json.str();
+}
+
+// Never destroyed: threads that outlive static destruction, such as the
+// default ThreadPool's, still release their blocks when they exit
+MetricsRegistry& MetricsRegistry::Get() {
+    static MetricsRegistry* const registry = new MetricsRegistry;
+    return *registry;
+}
+
+size_t MetricsRegistry::RegisterLatency(string name) {
+    return Register(latency_names_, MAX_LATENCIES, move(name));
+}
+
+size_t MetricsRegistry::RegisterCounter(string name) {
+    return Register(counter_names_, MAX_COUNTERS, move(name));
+}
+
+size_t MetricsRegistry::Register(vector<string>& names, size_t max_count, string name) {
+    lock_guard lock(mutex_);
+    const auto name_it = find(names.begin(), names.end(), name);
+    if (name_it != names.end()) {
+        return name_it - names.begin();
+    }
+    if (names.size() == max_count) {
+        throw length_error("too many metrics, can't register " + name);
+    }
+    names.push_back(move(name));
+    return names.size() - 1;
+}
+
+void MetricsRegistry::SetEnabled(bool is_enabled) {
+    is_enabled_.store(is_enabled, memory_order_relaxed);
+}
+
+// Single writer, so a load and a store make an increment nobody can lose
+static void Increment(atomic<uint64_t>& word, uint64_t value) {
+    word.store(word.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void MetricsRegistry::RecordLatency(size_t index, uint64_t nanoseconds) {
+    ThreadBlock& block = GetThreadBlock();
+    atomic<uint64_t>* histogram = block.latencies[index].load(memory_order_relaxed);
+    if (histogram == nullptr) {
+        lock_guard lock(mutex_);
+        histogram = histogram_storage_.emplace_back(new atomic<uint64_t>[HISTOGRAM_WORDS]{}).get();
+        block.latencies[index].store(histogram, memory_order_release);
+    }
+    Increment(histogram[LatencyHistogram::GetBucket(nanoseconds)], 1);
+    Increment(histogram[LatencyHistogram::BUCKET_COUNT], nanoseconds);
+}
+
+void MetricsRegistry::AddToCounter(size_t index, uint64_t value) {
+    Increment(GetThreadBlock().counters[index], value);
+}
+
+MetricsRegistry::ThreadBlockHolder::~ThreadBlockHolder() {
+    if (block != nullptr) {
+        block->is_taken.store(false, memory_order_release);
+    }
+}
+
+MetricsRegistry::ThreadBlock& MetricsRegistry::GetThreadBlock() {
+    thread_local ThreadBlockHolder holder;
+    if (holder.block == nullptr) {
+        lock_guard lock(mutex_);
+        for (ThreadBlock& block : blocks_) {
+            bool is_taken = false;
+            if (block.is_taken.compare_exchange_strong(is_taken, true, memory_order_acquire)) {
+                holder.block = &block;
+                break;
+            }
+        }
+        if (holder.block == nullptr) {
+            holder.block = &blocks_.emplace_back();
+        }
+    }
+    return *holder.block;
+}
+
+MetricsSnapshot MetricsRegistry::TakeSnapshot() const {
+    MetricsSnapshot snapshot;
+    snapshot.time = chrono::steady_clock::now();
+    lock_guard lock(mutex_);
+    for (const string& name : latency_names_) {
+        snapshot.latencies.push_back({ name, {} });
+    }
+    for (const string& name : counter_names_) {
+        snapshot.counters.push_back({ name, 0 });
+    }
+    for (const ThreadBlock& block : blocks_) {
+        for (size_t index = 0; index < latency_names_.size(); ++index) {
+            const atomic<uint64_t>* storage = block.latencies[index].load(memory_order_acquire);
+            if (storage == nullptr) {
+                continue;
+            }
+            // A histogram read while its thread records may be off by the
+            // records in progress, never by more
+            LatencyHistogram& histogram = snapshot.latencies[index].histogram;
+            for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+                const uint64_t count = storage[bucket].load(memory_order_relaxed);
+                histogram.buckets_[bucket] += count;
+                histogram.count_ += count;
+            }
+            histogram.sum_ += storage[LatencyHistogram::BUCKET_COUNT].load(memory_order_relaxed);
+        }
+        for (size_t index = 0; index < counter_names_.size(); ++index) {
+            snapshot.counters[index].value += block.counters[index].load(memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+PeriodicMetricsReporter::PeriodicMetricsReporter(chrono::milliseconds interval,
+    function<void(const MetricsSnapshot&)> sink)
+    : interval_(interval)
+    , sink_(move(sink))
+    , thread_([this] { Run(); })
+{}
+
+PeriodicMetricsReporter::~PeriodicMetricsReporter() {
+    {
+        lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    stop_requested_.notify_one();
+    thread_.join();
+}
+
+void PeriodicMetricsReporter::Run() {
+    MetricsSnapshot previous = MetricsRegistry::Get().TakeSnapshot();
+    unique_lock lock(mutex_);
+    for (bool is_last = false; !is_last;) {
+        is_last = stop_requested_.wait_for(lock, interval_, [this] { return is_stopping_; });
+        lock.unlock();
+        MetricsSnapshot current = MetricsRegistry::Get().TakeSnapshot();
+        sink_(current.Since(previous));
+        previous = move(current);
+        lock.lock();
+    }
+}
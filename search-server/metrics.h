@@ -0,0 +1,223 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define METRICS_CONCAT_INTERNAL(X, Y) X ## Y
+#define METRICS_CONCAT(X, Y) METRICS_CONCAT_INTERNAL(X, Y)
+// Records the time to the end of the scope into a LatencyMetric, the way
+// LOG_DURATION prints it
+#define RECORD_DURATION(metric) ScopedLatency METRICS_CONCAT(scopedLatency, __LINE__)(metric)
+// RECORD_DURATION only if condition holds when the scope starts
+#define RECORD_DURATION_IF(metric, condition) \
+    ScopedLatency METRICS_CONCAT(scopedLatency, __LINE__)((metric), (condition))
+
+// Latencies in nanoseconds bucketed log-linearly, the way HDR histograms
+// do: values below 16 get a bucket each, larger ones 16 buckets per power
+// of two, so any value is known to within 1/16 of itself and the whole
+// range of uint64_t fits 976 buckets.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const size_t SUB_BUCKET_COUNT = size_t{ 1 } << SUB_BUCKET_BITS;
+    static const size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    static size_t GetBucket(uint64_t value);
+    // Smallest value of the bucket
+    static uint64_t GetBucketStart(size_t bucket);
+
+    void Record(uint64_t value);
+    void Add(const LatencyHistogram& other);
+    // other must be an earlier state of this histogram
+    void Subtract(const LatencyHistogram& other);
+
+    uint64_t GetCount() const;
+    uint64_t GetSum() const;
+    // Middle of the bucket holding the value at fraction of the count, 0
+    // for an empty histogram
+    uint64_t GetPercentile(double fraction) const;
+    uint64_t GetMax() const;
+
+private:
+    friend class MetricsRegistry;  // sums the threads' histograms into snapshots
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+};
+
+// Named metric of the registry. Handles are meant to be defined once, as
+// globals or statics, and registered on construction.
+class LatencyMetric {
+public:
+    explicit LatencyMetric(std::string name);
+
+    void Record(std::chrono::nanoseconds duration) const;
+
+    size_t GetIndex() const {
+        return index_;
+    }
+
+private:
+    size_t index_;
+};
+
+class CounterMetric {
+public:
+    explicit CounterMetric(std::string name);
+
+    void Add(uint64_t value = 1) const;
+
+    size_t GetIndex() const {
+        return index_;
+    }
+
+private:
+    size_t index_;
+};
+
+// Sum of every thread's metrics at some moment
+class MetricsSnapshot {
+public:
+    struct Latency {
+        std::string name;
+        LatencyHistogram histogram;
+    };
+
+    struct Counter {
+        std::string name;
+        uint64_t value = 0;
+    };
+
+    std::chrono::steady_clock::time_point time;
+    std::vector<Latency> latencies;  // in order of registration
+    std::vector<Counter> counters;
+
+    // What was recorded between earlier and this snapshot
+    MetricsSnapshot Since(const MetricsSnapshot& earlier) const;
+
+    // One line per metric: count, mean, p50, p90, p99, p99.9 and max
+    std::string ToText() const;
+    std::string ToJson() const;
+};
+
+// Every thread records into a block of its own, with plain loads and stores
+// of relaxed atomics and no locks: a block has a single writer, its thread,
+// and the readers only add the blocks up. A block outlives its thread and
+// goes to the next new thread, so the totals keep what exited threads
+// recorded. Taking a snapshot locks only against threads starting.
+class MetricsRegistry {
+public:
+    static const size_t MAX_LATENCIES = 64;
+    static const size_t MAX_COUNTERS = 64;
+
+    static MetricsRegistry& Get();
+
+    // Throws std::length_error past MAX_LATENCIES or MAX_COUNTERS metrics.
+    // Registering a name twice gives the same metric.
+    size_t RegisterLatency(std::string name);
+    size_t RegisterCounter(std::string name);
+
+    // Recording is on by default; off, timers don't read the clock
+    void SetEnabled(bool is_enabled);
+    bool IsEnabled() const {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    void RecordLatency(size_t index, uint64_t nanoseconds);
+    void AddToCounter(size_t index, uint64_t value);
+
+    MetricsSnapshot TakeSnapshot() const;
+
+private:
+    // Written only by the thread it belongs to
+    struct ThreadBlock {
+        std::array<std::atomic<uint64_t>, MAX_COUNTERS> counters{};
+        // Storage of each latency metric's histogram, allocated on the
+        // thread's first record of the metric
+        std::array<std::atomic<std::atomic<uint64_t>*>, MAX_LATENCIES> latencies{};
+        std::atomic<bool> is_taken{ true };
+    };
+
+    // Releases the block when its thread exits
+    struct ThreadBlockHolder {
+        ThreadBlock* block = nullptr;
+        ~ThreadBlockHolder();
+    };
+
+    // A histogram's storage in a thread block: the buckets, then the sum
+    static const size_t HISTOGRAM_WORDS = LatencyHistogram::BUCKET_COUNT + 1;
+
+    MetricsRegistry() = default;
+
+    ThreadBlock& GetThreadBlock();
+    size_t Register(std::vector<std::string>& names, size_t max_count, std::string name);
+
+    std::atomic<bool> is_enabled_{ true };
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> latency_names_;
+    std::vector<std::string> counter_names_;
+    std::deque<ThreadBlock> blocks_;  // a deque, as atomics can't be moved
+    std::vector<std::unique_ptr<std::atomic<uint64_t>[]>> histogram_storage_;
+};
+
+// RECORD_DURATION
+class ScopedLatency {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ScopedLatency(const LatencyMetric& metric, bool is_wanted = true)
+        : metric_(metric)
+        , is_enabled_(is_wanted && MetricsRegistry::Get().IsEnabled())
+    {
+        if (is_enabled_) {
+            start_time_ = Clock::now();
+        }
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+    ~ScopedLatency() {
+        if (is_enabled_) {
+            metric_.Record(Clock::now() - start_time_);
+        }
+    }
+
+private:
+    const LatencyMetric& metric_;
+    bool is_enabled_;
+    Clock::time_point start_time_;
+};
+
+// Passes sink what was recorded in every interval, from a thread of its own
+class PeriodicMetricsReporter {
+public:
+    PeriodicMetricsReporter(std::chrono::milliseconds interval, std::function<void(const MetricsSnapshot&)> sink);
+    PeriodicMetricsReporter(const PeriodicMetricsReporter&) = delete;
+    PeriodicMetricsReporter& operator=(const PeriodicMetricsReporter&) = delete;
+    // Reports the last, partial interval before returning. Exceptions must
+    // not escape sink.
+    ~PeriodicMetricsReporter();
+
+private:
+    void Run();
+
+    std::chrono::milliseconds interval_;
+    std::function<void(const MetricsSnapshot&)> sink_;
+    std::mutex mutex_;
+    std::condition_variable stop_requested_;
+    bool is_stopping_ = false;
+    std::thread thread_;
+};
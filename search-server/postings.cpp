@@ -0,0 +1,125 @@
+#include "postings.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+PostingsList::PostingsList(FlatArray<uint32_t> ordinals, FlatArray<double> term_freqs, double max_term_freq)
+    : ordinals_(move(ordinals))
+    , term_freqs_(move(term_freqs))
+    , max_term_freq_(max_term_freq)
+{
+}
+
+void PostingsList::Insert(uint32_t ordinal, uint32_t term_count, uint32_t word_count) {
+    const double term_freq = ComputeTermFreq(term_count, word_count);
+    max_term_freq_ = max(max_term_freq_, term_freq);
+    vector<uint32_t>& ordinals = ordinals_.Mutable();
+    vector<double>& term_freqs = term_freqs_.Mutable();
+    if (ordinals.empty() || ordinals.back() < ordinal) {
+        ordinals.push_back(ordinal);
+        term_freqs.push_back(term_freq);
+        return;
+    }
+
+    const auto it = lower_bound(ordinals.begin(), ordinals.end(), ordinal);
+    const size_t pos = it - ordinals.begin();
+    if (*it == ordinal) {
+        term_freqs[pos] = term_freq;
+        return;
+    }
+    ordinals.insert(it, ordinal);
+    term_freqs.insert(term_freqs.begin() + pos, term_freq);
+}
+
+bool PostingsList::Erase(uint32_t ordinal) {
+    if (!Contains(ordinal)) {
+        return false;
+    }
+    vector<uint32_t>& ordinals = ordinals_.Mutable();
+    vector<double>& term_freqs = term_freqs_.Mutable();
+    const auto it = lower_bound(ordinals.begin(), ordinals.end(), ordinal);
+    const auto term_freq_it = term_freqs.begin() + (it - ordinals.begin());
+    const bool erases_max = *term_freq_it == max_term_freq_;
+    term_freqs.erase(term_freq_it);
+    ordinals.erase(it);
+    if (erases_max) {
+        max_term_freq_ = term_freqs.empty() ? 0.0 : *max_element(term_freqs.begin(), term_freqs.end());
+    }
+    return true;
+}
+
+size_t PostingsList::EraseAndRenumber(const vector<uint32_t>& erased_ordinals) {
+    if (erased_ordinals.empty()) {
+        return 0;
+    }
+    const size_t first_pos = lower_bound(ordinals_.begin(), ordinals_.end(), erased_ordinals.front()) - ordinals_.begin();
+    if (first_pos == ordinals_.size()) {
+        return 0;
+    }
+    vector<uint32_t>& ordinals = ordinals_.Mutable();
+    vector<double>& term_freqs = term_freqs_.Mutable();
+    // Walks both sorted lists together, moving the kept postings down in place.
+    // Once past the erased ordinals below a posting, their number is its shift.
+    auto erased_it = erased_ordinals.begin();
+    size_t kept_count = first_pos;
+    for (size_t pos = first_pos; pos < ordinals.size(); ++pos) {
+        while (erased_it != erased_ordinals.end() && *erased_it < ordinals[pos]) {
+            ++erased_it;
+        }
+        if (erased_it != erased_ordinals.end() && *erased_it == ordinals[pos]) {
+            continue;
+        }
+        ordinals[kept_count] = ordinals[pos] - static_cast<uint32_t>(erased_it - erased_ordinals.begin());
+        term_freqs[kept_count] = term_freqs[pos];
+        ++kept_count;
+    }
+    const size_t erased_count = ordinals.size() - kept_count;
+    ordinals.resize(kept_count);
+    term_freqs.resize(kept_count);
+    if (erased_count > 0) {
+        max_term_freq_ = term_freqs.empty() ? 0.0 : *max_element(term_freqs.begin(), term_freqs.end());
+    }
+    return erased_count;
+}
+
+bool PostingsList::Contains(uint32_t ordinal) const {
+    return binary_search(ordinals_.begin(), ordinals_.end(), ordinal);
+}
+
+size_t PostingsList::size() const {
+    return ordinals_.size();
+}
+
+bool PostingsList::empty() const {
+    return ordinals_.empty();
+}
+
+const FlatArray<uint32_t>& PostingsList::GetOrdinals() const {
+    return ordinals_;
+}
+
+const FlatArray<double>& PostingsList::GetTermFreqs() const {
+    return term_freqs_;
+}
+
+double PostingsList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+void PostingsCursor::SeekTo(uint32_t target) {
+    if (pos_ == size_ || ordinals_[pos_] >= target) {
+        return;
+    }
+    size_t step = 1;
+    size_t low = pos_;
+    size_t high = pos_ + step;
+    while (high < size_ && ordinals_[high] < target) {
+        low = high;
+        step *= 2;
+        high = low + step;
+    }
+    high = min(high, size_);
+    pos_ = lower_bound(ordinals_ + low, ordinals_ + high, target) - ordinals_;
+}
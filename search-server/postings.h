@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include "flat_array.h"
+
+#include <cstdint>
+#include <vector>
+
+// Term frequency of a term met term_count times among word_count words of a
+// document. Every postings format derives it from the same two counts, so
+// they all score bit-identically.
+inline double ComputeTermFreq(uint32_t term_count, uint32_t word_count) {
+    return static_cast<double>(term_count) / word_count;
+}
+
+class PostingsCursor;
+
+// Postings of a single term. Document ordinals are kept sorted in one
+// contiguous array and term frequencies in a parallel one (structure of
+// arrays), so a scan walks two linear ranges of memory instead of chasing
+// tree nodes.
+class PostingsList {
+public:
+    using Cursor = PostingsCursor;
+
+    PostingsList() = default;
+    // ordinals sorted ascending, term_freqs parallel to them
+    PostingsList(FlatArray<uint32_t> ordinals, FlatArray<double> term_freqs, double max_term_freq);
+
+    // Appends in O(1) when ordinal is greater than every stored one (always
+    // the case while indexing), otherwise inserts in order. An already
+    // present ordinal gets its term frequency replaced.
+    void Insert(uint32_t ordinal, uint32_t term_count, uint32_t word_count);
+
+    // Returns false if the list has no such ordinal.
+    bool Erase(uint32_t ordinal);
+    // Erases every one of ordinals, sorted ascending, the list has and moves
+    // each ordinal left down by the number of ordinals below it, so the
+    // list follows documents renumbered densely over the erased ones. A
+    // single pass; returns how many of ordinals the list had.
+    size_t EraseAndRenumber(const std::vector<uint32_t>& ordinals);
+
+    bool Contains(uint32_t ordinal) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // Largest term frequency in the list, the per-term bound used to prune
+    // documents that cannot reach the top results.
+    double GetMaxTermFreq() const;
+
+    const FlatArray<uint32_t>& GetOrdinals() const;
+    const FlatArray<double>& GetTermFreqs() const;
+
+private:
+    FlatArray<uint32_t> ordinals_;
+    FlatArray<double> term_freqs_;
+    double max_term_freq_ = 0.0;
+};
+
+// Forward-only position in a PostingsList for document-at-a-time traversal.
+class PostingsCursor {
+public:
+    explicit PostingsCursor(const PostingsList& postings)
+        : ordinals_(postings.GetOrdinals().data())
+        , term_freqs_(postings.GetTermFreqs().data())
+        , size_(postings.size())
+    {
+    }
+
+    bool AtEnd() const {
+        return pos_ == size_;
+    }
+
+    uint32_t GetOrdinal() const {
+        return ordinals_[pos_];
+    }
+
+    double GetTermFreq() const {
+        return term_freqs_[pos_];
+    }
+
+    void Next() {
+        ++pos_;
+    }
+
+    // Moves to the first posting whose ordinal is not less than target.
+    // Gallops from the current position, so a sequence of seeks over the
+    // whole list costs no more than a linear merge.
+    void SeekTo(uint32_t target);
+
+private:
+    const uint32_t* ordinals_;
+    const double* term_freqs_;
+    size_t size_;
+    size_t pos_ = 0;
+};
@@ -1,6 +1,11 @@
 #include "process_queries.h"
-#include <execution>
+#include "thread_pool.h"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <utility>
 
 using namespace std;
@@ -9,24 +14,156 @@ std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
     const std::vector<std::string>& queries)
 {
-    vector<vector<Document>> query_results(queries.size());
-    transform(execution::par, queries.begin(), queries.end(), query_results.begin(),
-                [&search_server](const string& query) {
-                    return search_server.FindTopDocuments(query);
-                }   
-    );
-    return query_results;
+    return search_server.FindTopDocumentsBatch(queries, *ThreadPool::GetDefault());
 }
 
 vector<Document> ProcessQueriesJoined(
     const SearchServer& search_server,
     const std::vector<std::string>& queries)
 {   
-    vector<vector<Document>> processed_queries = ProcessQueries(search_server, queries);
     vector<Document> flat_queries_results;
-    for (const auto& documents : processed_queries) {
-        flat_queries_results.insert(flat_queries_results.end(), 
-                                    make_move_iterator(documents.begin()), make_move_iterator(documents.end()));
-    }
+    ProcessQueriesJoined(search_server, queries,
+        [&flat_queries_results](Document&& document) {
+            flat_queries_results.push_back(move(document));
+        }
+    );
     return flat_queries_results;
+}
+
+void ProcessQueriesStreamed(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(size_t, std::vector<Document>&&)>& sink,
+    size_t window)
+{
+    const size_t queries_per_thread = 4;
+
+    // Reordering buffer: query i is answered into slot i % window, which
+    // the slot's previous query has left by the time i is submitted. The
+    // query is run by whoever starts it first, its pool task or the caller
+    // waiting for it.
+    struct Slot {
+        size_t query_index = 0;
+        bool is_started = false;
+        bool is_ready = false;
+        vector<Document> documents;
+        exception_ptr exception;
+    };
+    // Shared with the tasks, which may only run once the call has returned
+    // and then find their query taken
+    struct State {
+        std::mutex mutex;
+        condition_variable slot_ready;
+        vector<Slot> slots;
+        size_t running = 0;  // queries started by pool tasks and not done
+        bool is_abandoned = false;  // no query may start any more
+    };
+
+    const shared_ptr<ThreadPool> pool = ThreadPool::GetDefault();
+    if (window == 0) {
+        window = queries_per_thread * pool->GetThreadCount();
+    }
+    window = min(window, queries.size());
+    if (window == 0) {
+        return;
+    }
+    // Words the queries share are looked up once, as by ProcessQueries
+    const vector<SearchServer::Query> prepared_queries = search_server.PrepareQueryBatch(queries, *pool);
+    const auto state = make_shared<State>();
+    state->slots.resize(window);
+
+    // Runs the query unless it has started already; false then
+    const auto try_run = [&search_server, &prepared_queries](State& state, size_t query_index, bool is_task) {
+        Slot& slot = state.slots[query_index % state.slots.size()];
+        {
+            lock_guard lock(state.mutex);
+            if (state.is_abandoned || slot.query_index != query_index || slot.is_started) {
+                return false;
+            }
+            slot.is_started = true;
+            state.running += is_task ? 1 : 0;
+        }
+        vector<Document> documents;
+        exception_ptr exception;
+        try {
+            documents = search_server.FindTopDocumentsPrepared(prepared_queries[query_index]);
+        }
+        catch (...) {
+            exception = current_exception();
+        }
+        lock_guard lock(state.mutex);
+        slot.documents = move(documents);
+        slot.exception = exception;
+        slot.is_ready = true;
+        state.running -= is_task ? 1 : 0;
+        state.slot_ready.notify_all();
+        return true;
+    };
+    const auto submit = [&](size_t query_index) {
+        {
+            lock_guard lock(state->mutex);
+            Slot& slot = state->slots[query_index % window];
+            slot.query_index = query_index;
+            slot.is_started = false;
+        }
+        pool->Submit([state, try_run, query_index] {
+            try_run(*state, query_index, true);
+        });
+    };
+
+    exception_ptr exception;
+    try {
+        for (size_t query_index = 0; query_index < window; ++query_index) {
+            submit(query_index);
+        }
+        for (size_t query_index = 0; query_index < queries.size(); ++query_index) {
+            // The caller only ever helps with the query it waits for, so
+            // unrelated tasks of the pool never hold the stream up
+            Slot& slot = state->slots[query_index % window];
+            if (!try_run(*state, query_index, false)) {
+                unique_lock lock(state->mutex);
+                state->slot_ready.wait(lock, [&slot] { return slot.is_ready; });
+            }
+            vector<Document> documents;
+            {
+                lock_guard lock(state->mutex);
+                slot.is_ready = false;
+                documents = move(slot.documents);
+                if (slot.exception) {
+                    rethrow_exception(slot.exception);
+                }
+            }
+            if (query_index + window < queries.size()) {
+                submit(query_index + window);
+            }
+            sink(query_index, move(documents));
+        }
+    }
+    catch (...) {
+        exception = current_exception();
+    }
+    // Queries not started yet never will be; the running ones still use
+    // search_server and prepared_queries
+    {
+        unique_lock lock(state->mutex);
+        state->is_abandoned = true;
+        state->slot_ready.wait(lock, [&state] { return state->running == 0; });
+    }
+    if (exception) {
+        rethrow_exception(exception);
+    }
+}
+
+void ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(Document&&)>& sink)
+{
+    ProcessQueriesStreamed(search_server, queries,
+        [&sink](size_t, vector<Document>&& documents) {
+            for (Document& document : documents) {
+                sink(move(document));
+            }
+        }
+    );
 }
\ No newline at end of file
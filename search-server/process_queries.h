@@ -1,15 +1,40 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <vector>
 #include <string>
 #include <list>
 #include "document.h"
 #include "search_server.h"
 
+// All of these run on the default ThreadPool, sized by
+// ThreadPool::SetDefaultThreadCount, and look a word several queries share up
+// and give it its IDF once, as SearchServer::FindTopDocumentsBatch does
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
 std::vector<Document> ProcessQueriesJoined(
     const SearchServer& search_server,
-    const std::vector<std::string>& queries);
\ No newline at end of file
+    const std::vector<std::string>& queries);
+
+// Calls sink(query_index, documents) on the calling thread, in query order,
+// for every query as soon as it and all the earlier ones are answered. At
+// most window queries are being answered or wait for the earlier ones at a
+// time, so memory doesn't grow with the number of queries; a window of 0
+// means a few per thread of the default ThreadPool. The queries are parsed
+// up front, which takes memory in proportion to their text, not to their
+// results, so an invalid one throws before sink is first called. An
+// exception thrown by sink is rethrown once the queries in flight are done.
+void ProcessQueriesStreamed(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(size_t, std::vector<Document>&&)>& sink,
+    size_t window = 0);
+
+// sink gets the documents ProcessQueriesJoined would return, in its order
+void ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(Document&&)>& sink);
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "query_limits.h"
+
+using namespace std;
+
+CancellationToken::CancellationToken()
+    : is_cancelled_(make_shared<atomic<bool>>(false))
+{}
+
+void CancellationToken::Cancel() const {
+    is_cancelled_->store(true, memory_order_relaxed);
+}
+
+bool CancellationToken::IsCancelled() const {
+    return is_cancelled_->load(memory_order_relaxed);
+}
+
+QueryInterruptedError::QueryInterruptedError()
+    : runtime_error("query interrupted by its deadline or cancellation")
+{}
+
+QueryInterrupt::QueryInterrupt(const QueryLimits& limits)
+    : limits_(limits)
+{}
+
+bool QueryInterrupt::ShouldStop() const {
+    if (is_stopped_.load(memory_order_relaxed)) {
+        return true;
+    }
+    if (limits_.cancellation.IsCancelled()
+        || (limits_.deadline != chrono::steady_clock::time_point::max()
+            && chrono::steady_clock::now() >= limits_.deadline))
+    {
+        is_stopped_.store(true, memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool QueryInterrupt::IsStopped() const {
+    return is_stopped_.load(memory_order_relaxed);
+}
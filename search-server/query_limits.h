@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// Lets one thread ask queries running on others to stop. Copies share the
+// flag, so the caller keeps one and hands another to the query.
+class CancellationToken {
+public:
+    CancellationToken();
+
+    void Cancel() const;
+    bool IsCancelled() const;
+
+private:
+    std::shared_ptr<std::atomic<bool>> is_cancelled_;
+};
+
+// When an asynchronous query is to give up
+struct QueryLimits {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    CancellationToken cancellation;
+};
+
+// Thrown by queries that can't return a partial result once their limits
+// are reached
+class QueryInterruptedError : public std::runtime_error {
+public:
+    QueryInterruptedError();
+};
+
+// The limits of one query as its postings scan sees them. Once reached they
+// stay reached, so every thread of a parallel scan stops. Safe to check from
+// many threads at once.
+class QueryInterrupt {
+public:
+    explicit QueryInterrupt(const QueryLimits& limits);
+
+    // Reads the clock unless the deadline is infinite
+    bool ShouldStop() const;
+    // Whether ShouldStop has ever returned true
+    bool IsStopped() const;
+
+private:
+    QueryLimits limits_;
+    mutable std::atomic<bool> is_stopped_{ false };
+};
+
+// Checks a QueryInterrupt once every CHECK_INTERVAL polls, so a loop over
+// postings pays a decrement per posting rather than a clock read. A null
+// interrupt never stops.
+class InterruptPoller {
+public:
+    static const uint32_t CHECK_INTERVAL = 1024;
+
+    explicit InterruptPoller(const QueryInterrupt* interrupt)
+        : interrupt_(interrupt)
+    {
+    }
+
+    bool Poll() {
+        if (--countdown_ == 0) {
+            countdown_ = CHECK_INTERVAL;
+            is_stopped_ = interrupt_ != nullptr && interrupt_->ShouldStop();
+        }
+        return is_stopped_;
+    }
+
+    // As of the last poll
+    bool IsStopped() const {
+        return is_stopped_;
+    }
+
+private:
+    const QueryInterrupt* interrupt_;
+    uint32_t countdown_ = 1;  // the first poll checks
+    bool is_stopped_ = false;
+};
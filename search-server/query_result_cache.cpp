@@ -0,0 +1,80 @@
+#include "query_result_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+QueryResultCache::QueryResultCache(size_t capacity)
+    : capacity_(capacity)
+{
+    // Every shard holds at least one entry, so the capacity is never exceeded
+    const size_t shard_count = clamp(capacity, size_t{ 1 }, MAX_SHARD_COUNT);
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(make_unique<Shard>());
+        shards_.back()->capacity = capacity / shard_count + (i < capacity % shard_count ? 1 : 0);
+    }
+}
+
+optional<vector<Document>> QueryResultCache::Find(const string& key, uint64_t generation) {
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.mutex);
+    const auto entry_it = shard.entry_by_key.find(key);
+    if (entry_it == shard.entry_by_key.end()) {
+        ++shard.stats.misses;
+        return nullopt;
+    }
+    if (entry_it->second->generation != generation) {
+        shard.entries.erase(entry_it->second);
+        shard.entry_by_key.erase(entry_it);
+        ++shard.stats.misses;
+        return nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry_it->second);
+    ++shard.stats.hits;
+    return entry_it->second->documents;
+}
+
+void QueryResultCache::Insert(const string& key, uint64_t generation, vector<Document> documents) {
+    Shard& shard = GetShard(key);
+    if (shard.capacity == 0) {
+        return;
+    }
+    lock_guard lock(shard.mutex);
+    const auto entry_it = shard.entry_by_key.find(key);
+    if (entry_it != shard.entry_by_key.end()) {
+        // Another thread computed the same query meanwhile
+        entry_it->second->generation = generation;
+        entry_it->second->documents = move(documents);
+        shard.entries.splice(shard.entries.begin(), shard.entries, entry_it->second);
+        return;
+    }
+    if (shard.entries.size() == shard.capacity) {
+        shard.entry_by_key.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+        ++shard.stats.evictions;
+    }
+    shard.entries.push_front({ key, generation, move(documents) });
+    shard.entry_by_key.emplace(shard.entries.front().key, shard.entries.begin());
+}
+
+size_t QueryResultCache::GetCapacity() const {
+    return capacity_;
+}
+
+QueryResultCache::Stats QueryResultCache::GetStats() const {
+    Stats stats;
+    for (const unique_ptr<Shard>& shard : shards_) {
+        lock_guard lock(shard->mutex);
+        stats.hits += shard->stats.hits;
+        stats.misses += shard->stats.misses;
+        stats.evictions += shard->stats.evictions;
+        stats.size += shard->entries.size();
+    }
+    return stats;
+}
+
+QueryResultCache::Shard& QueryResultCache::GetShard(string_view key) {
+    return *shards_[hash<string_view>{}(key) % shards_.size()];
+}
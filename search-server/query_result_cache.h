@@ -0,0 +1,61 @@
+#pragma once
+#include "document.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Size-bounded LRU cache of search results, safe to use from many threads.
+// Keys are spread over shards with a mutex and an LRU list each, so parallel
+// queries seldom wait on one another. Every entry carries the index
+// generation it was computed for; looking it up with another generation
+// drops it, so a change to the index invalidates the whole cache at the cost
+// of bumping a counter.
+class QueryResultCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;       // stale entries included
+        uint64_t evictions = 0;    // entries pushed out to make room
+        size_t size = 0;
+    };
+
+    explicit QueryResultCache(size_t capacity);
+
+    // Empty on a miss
+    std::optional<std::vector<Document>> Find(const std::string& key, uint64_t generation);
+
+    void Insert(const std::string& key, uint64_t generation, std::vector<Document> documents);
+
+    size_t GetCapacity() const;
+    Stats GetStats() const;
+
+private:
+    static constexpr size_t MAX_SHARD_COUNT = 16;
+
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::vector<Document> documents;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        size_t capacity = 0;
+        std::list<Entry> entries;  // most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> entry_by_key;  // keys view entries
+        Stats stats;
+    };
+
+    Shard& GetShard(std::string_view key);
+
+    size_t capacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -1,33 +1,318 @@
 #include "remove_duplicates.h"
 
-#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
 #include <vector>
-#include <iostream>
+#include "thread_pool.h"
 
 using namespace std;
 
-void RemoveDuplicates(SearchServer& search_server) {
-    set< set<string_view> > unique_documents_content;
-    vector<int> duplicates_to_erase; /* container that saves duplicates ids to erase them after "range-based for"
-                                     finishes its job in order not to invalidate the iterator */
-    for (const int document_id : search_server) {
-        set<string_view> document_words_set;
-        for (const auto& [word, TF] : search_server.GetWordFrequencies(document_id)) {
-            document_words_set.insert(word);
+namespace {
+
+// Finalizer of splitmix64: every input bit affects every output bit
+uint64_t MixBits(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value;
+}
+
+// Term ids are shared by all documents, so equal word sets have equal term
+// id sequences and fingerprints
+uint64_t ComputeFingerprint(const FlatArray<TermCount>& term_counts) {
+    uint64_t fingerprint = MixBits(term_counts.size());
+    for (const TermCount& term_count : term_counts) {
+        fingerprint = MixBits(fingerprint ^ term_count.term_id);
+    }
+    return fingerprint;
+}
+
+bool HaveSameWords(const FlatArray<TermCount>& lhs, const FlatArray<TermCount>& rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+        [](const TermCount& lhs, const TermCount& rhs) {
+            return lhs.term_id == rhs.term_id;
         }
+    );
+}
 
-        if (unique_documents_content.count(document_words_set)) {
-            // cout << "Found duplicate document id "s << document_id << endl; 
-            // search_server.RemoveDocument(document_id); 
-            duplicates_to_erase.push_back(document_id);
+// Jaccard similarity of the word sets, 1 for two empty ones
+double ComputeSimilarity(const FlatArray<TermCount>& lhs, const FlatArray<TermCount>& rhs) {
+    if (lhs.empty() && rhs.empty()) {
+        return 1.0;
+    }
+    size_t common_count = 0;
+    const TermCount* lhs_it = lhs.begin();
+    const TermCount* rhs_it = rhs.begin();
+    while (lhs_it != lhs.end() && rhs_it != rhs.end()) {
+        if (lhs_it->term_id < rhs_it->term_id) {
+            ++lhs_it;
+        }
+        else if (rhs_it->term_id < lhs_it->term_id) {
+            ++rhs_it;
         }
         else {
-            unique_documents_content.insert(document_words_set);
+            ++common_count;
+            ++lhs_it;
+            ++rhs_it;
         }
     }
+    return static_cast<double>(common_count) / (lhs.size() + rhs.size() - common_count);
+}
 
-    for (const int id_to_erase : duplicates_to_erase) {
-        cout << "Found duplicate document id "s << id_to_erase << endl;
-        search_server.RemoveDocument(id_to_erase);
+// The documents in id order with their forward index
+struct Documents {
+    vector<int> ids;
+    vector<const FlatArray<TermCount>*> term_counts;
+    vector<size_t> indexes;  // 0, 1, 2... for ForEach
+};
+
+template <typename ExecutionPolicy>
+Documents GetDocuments(ExecutionPolicy& policy, const SearchServer& search_server) {
+    Documents documents;
+    documents.ids.assign(search_server.begin(), search_server.end());
+    documents.term_counts.resize(documents.ids.size());
+    documents.indexes.resize(documents.ids.size());
+    iota(documents.indexes.begin(), documents.indexes.end(), 0);
+    ForEach(
+        policy,
+        documents.indexes.begin(), documents.indexes.end(),
+        [&search_server, &documents](size_t index) {
+            documents.term_counts[index] = &search_server.GetTermCounts(documents.ids[index]);
+        }
+    );
+    return documents;
+}
+
+vector<int> GetMarkedIds(const Documents& documents, const vector<char>& is_marked) {
+    vector<int> ids;
+    for (size_t index = 0; index < documents.ids.size(); ++index) {
+        if (is_marked[index]) {
+            ids.push_back(documents.ids[index]);
+        }
     }
-}
\ No newline at end of file
+    return ids;
+}
+
+template <typename ExecutionPolicy>
+vector<int> FindDuplicatesWith(ExecutionPolicy& policy, const SearchServer& search_server) {
+    const Documents documents = GetDocuments(policy, search_server);
+
+    // Sorting by fingerprint, then by index, puts every group of look-alikes
+    // together with its smallest id, the one kept, first
+    vector<pair<uint64_t, uint32_t>> fingerprints(documents.ids.size());
+    ForEach(
+        policy,
+        documents.indexes.begin(), documents.indexes.end(),
+        [&documents, &fingerprints](size_t index) {
+            fingerprints[index] = { ComputeFingerprint(*documents.term_counts[index]), static_cast<uint32_t>(index) };
+        }
+    );
+    sort(fingerprints.begin(), fingerprints.end());
+
+    vector<pair<size_t, size_t>> groups;  // ranges of fingerprints shared by several documents
+    for (size_t begin = 0, end = 0; begin < fingerprints.size(); begin = end) {
+        while (end < fingerprints.size() && fingerprints[end].first == fingerprints[begin].first) {
+            ++end;
+        }
+        if (end - begin > 1) {
+            groups.push_back({ begin, end });
+        }
+    }
+
+    // A group almost always holds a single word set; a collision makes it
+    // hold several, each kept once
+    vector<char> is_duplicate(documents.ids.size(), 0);
+    ForEach(
+        policy,
+        groups.begin(), groups.end(),
+        [&documents, &fingerprints, &is_duplicate](const pair<size_t, size_t>& group) {
+            vector<uint32_t> kept;
+            for (size_t position = group.first; position < group.second; ++position) {
+                const uint32_t index = fingerprints[position].second;
+                const bool is_seen = any_of(kept.begin(), kept.end(),
+                    [&documents, index](uint32_t kept_index) {
+                        return HaveSameWords(*documents.term_counts[kept_index], *documents.term_counts[index]);
+                    }
+                );
+                if (is_seen) {
+                    is_duplicate[index] = 1;
+                }
+                else {
+                    kept.push_back(index);
+                }
+            }
+        }
+    );
+    return GetMarkedIds(documents, is_duplicate);
+}
+
+template <typename ExecutionPolicy>
+vector<int> FindNearDuplicatesWith(ExecutionPolicy& policy, const SearchServer& search_server,
+    const NearDuplicateOptions& options)
+{
+    if (!(options.min_similarity > 0.0 && options.min_similarity <= 1.0)) {
+        throw invalid_argument("min_similarity must be in (0, 1]");
+    }
+    if (options.band_count == 0 || options.rows_per_band == 0) {
+        throw invalid_argument("a MinHash signature needs at least one band and row");
+    }
+    const Documents documents = GetDocuments(policy, search_server);
+    const size_t document_count = documents.ids.size();
+    const size_t hash_count = options.band_count * options.rows_per_band;
+
+    // The signature holds the smallest value of hash_count hash functions
+    // over the document's term ids, h1 + k * h2 for k = 0, 1... as double
+    // hashing derives them from two, mixed once more: unmixed, a term with
+    // small h1 and h2 would be the smallest under most of them, and documents
+    // would share or differ in whole signatures by that one term. Only the
+    // hashes of its bands are kept.
+    vector<vector<pair<uint64_t, uint32_t>>> bands(options.band_count,
+        vector<pair<uint64_t, uint32_t>>(document_count));
+    ForEach(
+        policy,
+        documents.indexes.begin(), documents.indexes.end(),
+        [&](size_t index) {
+            thread_local vector<uint64_t> signature;
+            signature.assign(hash_count, numeric_limits<uint64_t>::max());
+            for (const TermCount& term_count : *documents.term_counts[index]) {
+                const uint64_t first_hash = MixBits(term_count.term_id);
+                const uint64_t second_hash = MixBits(first_hash) | 1;
+                uint64_t hash = first_hash;
+                for (uint64_t& value : signature) {
+                    value = min(value, MixBits(hash));
+                    hash += second_hash;
+                }
+            }
+            for (size_t band = 0; band < options.band_count; ++band) {
+                uint64_t band_hash = MixBits(band);
+                for (size_t row = 0; row < options.rows_per_band; ++row) {
+                    band_hash = MixBits(band_hash ^ signature[band * options.rows_per_band + row]);
+                }
+                bands[band][index] = { band_hash, static_cast<uint32_t>(index) };
+            }
+        }
+    );
+
+    // Candidate pairs, the later document first
+    vector<vector<pair<uint32_t, uint32_t>>> band_candidates(options.band_count);
+    ForEach(
+        policy,
+        bands.begin(), bands.end(),
+        [&bands, &band_candidates, &options](vector<pair<uint64_t, uint32_t>>& band) {
+            sort(band.begin(), band.end());
+            vector<pair<uint32_t, uint32_t>>& candidates = band_candidates[&band - bands.data()];
+            for (size_t begin = 0, position = 0; position < band.size(); ++position) {
+                if (band[position].first != band[begin].first) {
+                    begin = position;
+                }
+                const size_t first_earlier = max(begin, position - min(position, options.max_candidates_per_band));
+                for (size_t earlier = first_earlier; earlier < position; ++earlier) {
+                    candidates.push_back({ band[position].second, band[earlier].second });
+                }
+            }
+            band = {};
+        }
+    );
+    vector<pair<uint32_t, uint32_t>> candidates;
+    for (vector<pair<uint32_t, uint32_t>>& band : band_candidates) {
+        candidates.insert(candidates.end(), band.begin(), band.end());
+        band = {};
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+    vector<char> is_similar(candidates.size(), 0);
+    ForEach(
+        policy,
+        candidates.begin(), candidates.end(),
+        [&](const pair<uint32_t, uint32_t>& candidate) {
+            is_similar[&candidate - candidates.data()] =
+                ComputeSimilarity(*documents.term_counts[candidate.first], *documents.term_counts[candidate.second])
+                >= options.min_similarity;
+        }
+    );
+
+    // Similarity isn't transitive, so a document is only dropped for one
+    // that is kept. Candidates come in the order of their later document,
+    // whose earlier ones are decided by then.
+    vector<char> is_duplicate(document_count, 0);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const auto [later, earlier] = candidates[i];
+        if (is_similar[i] && !is_duplicate[earlier]) {
+            is_duplicate[later] = 1;
+        }
+    }
+    return GetMarkedIds(documents, is_duplicate);
+}
+
+}  // namespace
+
+vector<int> FindDuplicates(const SearchServer& search_server) {
+    return FindDuplicates(execution::seq, search_server);
+}
+
+vector<int> FindDuplicates(execution::parallel_policy policy, const SearchServer& search_server) {
+    return FindDuplicatesWith(policy, search_server);
+}
+
+vector<int> FindDuplicates(execution::sequenced_policy policy, const SearchServer& search_server) {
+    return FindDuplicatesWith(policy, search_server);
+}
+
+vector<int> RemoveDuplicates(SearchServer& search_server) {
+    return RemoveDuplicates(execution::seq, search_server);
+}
+
+vector<int> RemoveDuplicates(execution::parallel_policy policy, SearchServer& search_server) {
+    vector<int> duplicates = FindDuplicates(policy, search_server);
+    search_server.RemoveDocuments(policy, duplicates);
+    return duplicates;
+}
+
+vector<int> RemoveDuplicates(execution::sequenced_policy policy, SearchServer& search_server) {
+    vector<int> duplicates = FindDuplicates(policy, search_server);
+    search_server.RemoveDocuments(policy, duplicates);
+    return duplicates;
+}
+
+vector<int> FindNearDuplicates(const SearchServer& search_server, const NearDuplicateOptions& options) {
+    return FindNearDuplicates(execution::seq, search_server, options);
+}
+
+vector<int> FindNearDuplicates(execution::parallel_policy policy, const SearchServer& search_server,
+    const NearDuplicateOptions& options)
+{
+    return FindNearDuplicatesWith(policy, search_server, options);
+}
+
+vector<int> FindNearDuplicates(execution::sequenced_policy policy, const SearchServer& search_server,
+    const NearDuplicateOptions& options)
+{
+    return FindNearDuplicatesWith(policy, search_server, options);
+}
+
+vector<int> RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options) {
+    return RemoveNearDuplicates(execution::seq, search_server, options);
+}
+
+vector<int> RemoveNearDuplicates(execution::parallel_policy policy, SearchServer& search_server,
+    const NearDuplicateOptions& options)
+{
+    vector<int> duplicates = FindNearDuplicates(policy, search_server, options);
+    search_server.RemoveDocuments(policy, duplicates);
+    return duplicates;
+}
+
+vector<int> RemoveNearDuplicates(execution::sequenced_policy policy, SearchServer& search_server,
+    const NearDuplicateOptions& options)
+{
+    vector<int> duplicates = FindNearDuplicates(policy, search_server, options);
+    search_server.RemoveDocuments(policy, duplicates);
+    return duplicates;
+}
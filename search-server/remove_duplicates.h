@@ -1,6 +1,54 @@
 #pragma once
 
+#include <cstddef>
+#include <execution>
+#include <vector>
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
- 
\ No newline at end of file
+// Ids of the documents whose set of words equals that of a document with a
+// smaller id, ascending. Documents are grouped by a 64-bit fingerprint of
+// their word sets, computed in parallel by the parallel version, and the
+// sets of a group are compared exactly, so a fingerprint collision never
+// makes a duplicate.
+std::vector<int> FindDuplicates(const SearchServer& search_server);
+std::vector<int> FindDuplicates(std::execution::parallel_policy policy, const SearchServer& search_server);
+std::vector<int> FindDuplicates(std::execution::sequenced_policy policy, const SearchServer& search_server);
+
+// Removes what FindDuplicates finds in one batch and returns their ids
+std::vector<int> RemoveDuplicates(SearchServer& search_server);
+std::vector<int> RemoveDuplicates(std::execution::parallel_policy policy, SearchServer& search_server);
+std::vector<int> RemoveDuplicates(std::execution::sequenced_policy policy, SearchServer& search_server);
+
+struct NearDuplicateOptions {
+    // Jaccard similarity of the word sets from which on a document is a
+    // near-duplicate
+    double min_similarity = 0.8;
+    // The MinHash signature has band_count * rows_per_band hashes. Documents
+    // are compared if all the rows of any band agree, which for similarity s
+    // happens with probability 1 - (1 - s^rows)^bands: with the defaults,
+    // 99.9% at 0.8, 47% at 0.5 and 5% at 0.3.
+    size_t band_count = 20;
+    size_t rows_per_band = 5;
+    // Bounds the comparisons a document with many look-alikes costs: it is
+    // compared with at most this many of the documents before it in each of
+    // its bands
+    size_t max_candidates_per_band = 64;
+};
+
+// Ids of the documents whose word sets are at least options.min_similarity
+// similar to those of a document with a smaller id that is not itself one,
+// ascending. Candidates come from MinHash signatures bucketed by LSH bands
+// and are checked with the exact similarity, so a pair may be missed with
+// the small probability the bands allow but never found wrongly.
+std::vector<int> FindNearDuplicates(const SearchServer& search_server, const NearDuplicateOptions& options = {});
+std::vector<int> FindNearDuplicates(std::execution::parallel_policy policy, const SearchServer& search_server,
+    const NearDuplicateOptions& options = {});
+std::vector<int> FindNearDuplicates(std::execution::sequenced_policy policy, const SearchServer& search_server,
+    const NearDuplicateOptions& options = {});
+
+// Removes what FindNearDuplicates finds in one batch and returns their ids
+std::vector<int> RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options = {});
+std::vector<int> RemoveNearDuplicates(std::execution::parallel_policy policy, SearchServer& search_server,
+    const NearDuplicateOptions& options = {});
+std::vector<int> RemoveNearDuplicates(std::execution::sequenced_policy policy, SearchServer& search_server,
+    const NearDuplicateOptions& options = {});
@@ -1,25 +1,124 @@
 #include "request_queue.h"
 
+#include <algorithm>
+
 using namespace std;
 
-RequestQueue::RequestQueue(const SearchServer& search_server) 
+namespace {
+
+// The counter shard of the calling thread, the same in every RequestQueue
+size_t GetThisThreadShard(size_t shard_count) {
+    static atomic<size_t> next_shard{ 0 };
+    thread_local const size_t shard = next_shard.fetch_add(1, memory_order_relaxed);
+    return shard % shard_count;
+}
+
+}  // namespace
+
+RequestQueue::RequestQueue(const SearchServer& search_server, Clock::duration window, size_t capacity)
     : search_server_(search_server)
-    , current_time_(0)
-    , no_result_requests_count_(0)
+    , window_(window)
+    , creation_time_(Clock::now())
+    , capacity_(max<size_t>(1, capacity))
+    , slots_(make_unique<Slot[]>(capacity_))
 {
 }
 
 int RequestQueue::GetNoResultRequests() const {
-    return no_result_requests_count_;
+    return static_cast<int>(GetStats().no_result_count);
 }
 
 vector<Document> RequestQueue::AddFindRequest(const string& raw_query, DocumentStatus status) {
-    return RequestQueue::AddFindRequest(raw_query, 
+    return RequestQueue::AddFindRequest(raw_query,
                             [status](int document_id, DocumentStatus doc_status, int rating)
-                            { return doc_status == status; } 
-    ); 
+                            { return doc_status == status; }
+    );
 }
 
 vector<Document> RequestQueue::AddFindRequest(const string& raw_query) {
-    return RequestQueue::AddFindRequest(raw_query, DocumentStatus::ACTUAL);  
-}
\ No newline at end of file
+    return RequestQueue::AddFindRequest(raw_query, DocumentStatus::ACTUAL);
+}
+
+void RequestQueue::Record(Clock::time_point start_time, size_t result_count) {
+    const Clock::time_point end_time = Clock::now();
+
+    CounterShard& shard = counter_shards_[GetThisThreadShard(COUNTER_SHARD_COUNT)];
+    shard.request_count.fetch_add(1, memory_order_relaxed);
+    if (result_count == 0) {
+        shard.no_result_count.fetch_add(1, memory_order_relaxed);
+    }
+
+    const uint64_t ticket = next_ticket_.fetch_add(1, memory_order_relaxed);
+    Slot& slot = slots_[ticket % capacity_];
+    const uint64_t writing = 2 * ticket + 1;
+    // Only one request writes a slot at a time. The slot is still being
+    // written only if the ring came around while a request capacity tickets
+    // older was being recorded; that one keeps the slot and this record is
+    // dropped, rather than waited for.
+    uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+    do {
+        if (sequence % 2 == 1 || sequence > writing) {
+            return;
+        }
+    } while (!slot.sequence.compare_exchange_weak(sequence, writing, memory_order_relaxed));
+    atomic_thread_fence(memory_order_release);
+
+    slot.time.store(end_time.time_since_epoch().count(), memory_order_relaxed);
+    slot.latency.store(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count()),
+        memory_order_relaxed);
+    slot.result_count.store(result_count, memory_order_relaxed);
+    slot.sequence.store(writing + 1, memory_order_release);
+}
+
+RequestQueue::Stats RequestQueue::GetStats() const {
+    Stats stats;
+    for (const CounterShard& shard : counter_shards_) {
+        stats.total_request_count += shard.request_count.load(memory_order_relaxed);
+        stats.total_no_result_count += shard.no_result_count.load(memory_order_relaxed);
+    }
+
+    const Clock::time_point now = Clock::now();
+    const Clock::time_point window_start = now - window_;
+    const uint64_t ticket_count = next_ticket_.load(memory_order_relaxed);
+    const size_t used_slot_count = static_cast<size_t>(min<uint64_t>(ticket_count, capacity_));
+
+    Clock::time_point oldest_time = Clock::time_point::max();
+    for (size_t index = 0; index < used_slot_count; ++index) {
+        const Slot& slot = slots_[index];
+        const uint64_t sequence = slot.sequence.load(memory_order_acquire);
+        if (sequence == 0 || sequence % 2 == 1) {
+            continue;
+        }
+        const Clock::time_point time{ Clock::duration(slot.time.load(memory_order_relaxed)) };
+        const uint64_t latency = slot.latency.load(memory_order_relaxed);
+        const size_t result_count = static_cast<size_t>(slot.result_count.load(memory_order_relaxed));
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) != sequence) {
+            continue;  // rewritten while read
+        }
+
+        oldest_time = min(oldest_time, time);
+        if (time < window_start) {
+            continue;
+        }
+        ++stats.request_count;
+        if (result_count == 0) {
+            ++stats.no_result_count;
+        }
+        stats.latencies.Record(latency);
+        if (stats.result_size_counts.size() <= result_count) {
+            stats.result_size_counts.resize(result_count + 1);
+        }
+        ++stats.result_size_counts[result_count];
+    }
+
+    // A full ring whose oldest record is in the window has lost the
+    // requests before it
+    const bool is_truncated = ticket_count >= capacity_ && oldest_time > window_start;
+    const Clock::time_point covered_start = is_truncated ? oldest_time : max(window_start, creation_time_);
+    stats.covered_time = max(Clock::duration::zero(), now - covered_start);
+    if (stats.covered_time > Clock::duration::zero()) {
+        stats.queries_per_second = stats.request_count / chrono::duration<double>(stats.covered_time).count();
+    }
+    return stats;
+}
@@ -1,13 +1,45 @@
 #pragma once
-#include <deque>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
+#include "metrics.h"
 #include "search_server.h"
 
+// Statistics of the requests made through it over a sliding window of real
+// time. Requests from many threads at once are safe and take no locks: each
+// one claims a slot of a fixed-size ring buffer with an atomic increment and
+// publishes its record there, and the statistics are computed from the ring
+// when asked for. When more than capacity requests come in a window, the
+// statistics cover the latest capacity of them.
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server);
-    
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t DEFAULT_CAPACITY = size_t{ 1 } << 14;
+
+    struct Stats {
+        size_t request_count = 0;  // in the window
+        size_t no_result_count = 0;
+        // The part of the window the statistics cover: shorter than the
+        // window for a new queue or one whose ring overflowed
+        Clock::duration covered_time{ 0 };
+        double queries_per_second = 0.0;
+        LatencyHistogram latencies;  // in nanoseconds
+        // Number of requests by the number of documents they found
+        std::vector<size_t> result_size_counts;
+        // Since construction, including the requests outside the window
+        uint64_t total_request_count = 0;
+        uint64_t total_no_result_count = 0;
+    };
+
+    explicit RequestQueue(const SearchServer& search_server,
+        Clock::duration window = std::chrono::hours(24), size_t capacity = DEFAULT_CAPACITY);
+
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
 
@@ -15,41 +47,46 @@ public:
 
     std::vector<Document> AddFindRequest(const std::string& raw_query);
 
+    // Requests in the window that found nothing
     int GetNoResultRequests() const;
 
+    Stats GetStats() const;
+
 private:
-    struct QueryResult {
-        uint64_t timestamp;
-        size_t results; 
+    // A seqlock: sequence is odd while the record is written, and
+    // 2 * (ticket + 1) once the request with that ticket has published it
+    struct Slot {
+        std::atomic<uint64_t> sequence{ 0 };
+        std::atomic<int64_t> time{ 0 };  // of the request's end, in clock ticks
+        std::atomic<uint64_t> latency{ 0 };  // in nanoseconds
+        std::atomic<uint64_t> result_count{ 0 };
     };
-    std::deque<QueryResult> requests_;
-    const static int min_in_day_ = 1440;
+
+    // Lifetime totals, striped so threads rarely share a cache line
+    struct alignas(64) CounterShard {
+        std::atomic<uint64_t> request_count{ 0 };
+        std::atomic<uint64_t> no_result_count{ 0 };
+    };
+
+    static const size_t COUNTER_SHARD_COUNT = 16;
+
+    void Record(Clock::time_point start_time, size_t result_count);
+
     const SearchServer& search_server_;
-    uint64_t current_time_;
-    int no_result_requests_count_; 
+    const Clock::duration window_;
+    const Clock::time_point creation_time_;
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<uint64_t> next_ticket_{ 0 };
+    std::array<CounterShard, COUNTER_SHARD_COUNT> counter_shards_;
 };
 
 
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-    const std::vector<Document> found_documents = search_server_.FindTopDocuments(raw_query, document_predicate);
-    ++current_time_;
-    if (current_time_ > min_in_day_) {
-        if (requests_.front().results == 0) {
-            --no_result_requests_count_;
-        }
-        requests_.pop_front();
-    }
-
-    if (found_documents.empty()) {
-        requests_.push_back({current_time_, found_documents.size()});
-        ++no_result_requests_count_;
-    }
-    else {
-        requests_.push_back({current_time_, found_documents.size()});
-    }  
+    const Clock::time_point start_time = Clock::now();
+    std::vector<Document> found_documents = search_server_.FindTopDocuments(raw_query, document_predicate);
+    Record(start_time, found_documents.size());
     return found_documents;
 }
-
-
@@ -0,0 +1,24 @@
+#include "score_accumulator.h"
+
+using namespace std;
+
+ScoreAccumulator& ScoreAccumulator::ForThisThread(size_t ordinal_count) {
+    thread_local ScoreAccumulator accumulator;
+    accumulator.Reserve(ordinal_count);
+    return accumulator;
+}
+
+void ScoreAccumulator::Clear() {
+    for (const uint32_t ordinal : touched_) {
+        relevances_[ordinal] = 0.0;
+        states_[ordinal] = State::UNSEEN;
+    }
+    touched_.clear();
+}
+
+void ScoreAccumulator::Reserve(size_t ordinal_count) {
+    if (relevances_.size() < ordinal_count) {
+        relevances_.resize(ordinal_count, 0.0);
+        states_.resize(ordinal_count, State::UNSEEN);
+    }
+}
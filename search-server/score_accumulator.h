@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-query relevance scratch indexed by document ordinal. Every ordinal that
+// leaves the UNSEEN state is recorded in the touched list, so Clear() costs as
+// much as the query did rather than the size of the corpus and the arrays can
+// be reused from query to query.
+class ScoreAccumulator {
+public:
+    enum class State : uint8_t {
+        UNSEEN,
+        ACCEPTED,  // passed the document predicate, relevance is being summed
+        REJECTED,  // failed the predicate or was excluded by a minus-word
+    };
+
+    // Scratch of the calling thread, grown to hold ordinal_count entries.
+    static ScoreAccumulator& ForThisThread(size_t ordinal_count);
+
+    State GetState(uint32_t ordinal) const {
+        return states_[ordinal];
+    }
+
+    void Accept(uint32_t ordinal) {
+        states_[ordinal] = State::ACCEPTED;
+        touched_.push_back(ordinal);
+    }
+
+    void Reject(uint32_t ordinal) {
+        if (states_[ordinal] == State::UNSEEN) {
+            touched_.push_back(ordinal);
+        }
+        states_[ordinal] = State::REJECTED;
+    }
+
+    void Add(uint32_t ordinal, double relevance) {
+        relevances_[ordinal] += relevance;
+    }
+
+    double GetRelevance(uint32_t ordinal) const {
+        return relevances_[ordinal];
+    }
+
+    const std::vector<uint32_t>& GetTouched() const {
+        return touched_;
+    }
+
+    void Clear();
+
+private:
+    void Reserve(size_t ordinal_count);
+
+    std::vector<double> relevances_;
+    std::vector<State> states_;
+    std::vector<uint32_t> touched_;
+};
+
+// Clears the accumulator on scope exit, including when scoring throws.
+class AccumulatorGuard {
+public:
+    explicit AccumulatorGuard(ScoreAccumulator& accumulator)
+        : accumulator_(accumulator)
+    {
+    }
+
+    ~AccumulatorGuard() {
+        accumulator_.Clear();
+    }
+
+private:
+    ScoreAccumulator& accumulator_;
+};
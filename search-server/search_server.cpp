@@ -8,13 +8,31 @@
 #include <string_view>
 #include <chrono>
 #include <thread>
+#include <unordered_set>
 #include "search_server.h"
 #include "document.h"
 #include "log_duration.h"
+#include "snapshot.h"
+#include "thread_pool.h"
 
 
 using namespace std;
 
+InvalidBatchError::InvalidBatchError(vector<Rejection> rejections)
+    : invalid_argument(to_string(rejections.size()) + " document(s) of the batch rejected, the first one is "s
+        + to_string(rejections.front().document_id) + ": "s + rejections.front().reason)
+    , rejections_(move(rejections))
+{}
+
+const vector<InvalidBatchError::Rejection>& InvalidBatchError::GetRejections() const {
+    return rejections_;
+}
+
+const SearchMetrics& GetSearchMetrics() {
+    static const SearchMetrics metrics;
+    return metrics;
+}
+
 SearchServer::SearchServer(const string& stop_words_string)
     : SearchServer(string_view(stop_words_string))
 {}
@@ -26,40 +44,311 @@ SearchServer::SearchServer(string_view stop_words_string_view)
 
 
 void SearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& marks) {
-    if (document_id < 0 || documents_.count(document_id) > 0) {
+    if (document_id < 0 || document_id_to_ordinal_.count(document_id) > 0) {
         throw invalid_argument("invalind document id"s);
     }
 
-    const auto [it, inserted] = documents_.emplace(document_id, DocumentData{ ComputeAverageRating(marks), status, string(document) });
-    vector<string_view> words = SplitIntoWordsNoStop((it->second).doc_text);
+    const vector<string_view> words = SplitIntoWordsNoStop(document);
+
+    const uint32_t ordinal = documents_.size();
+    DocumentData& document_data = documents_.emplace_back(
+        DocumentData{ document_id, ComputeAverageRating(marks), status, static_cast<uint32_t>(words.size()), {} });
+    if (text_storage_mode_ == TextStorageMode::KEEP) {
+        document_texts_.Store(ordinal, document);
+    }
 
-    const double inv_word_count = 1.0 / words.size();
+    vector<TermId> term_ids;
+    term_ids.reserve(words.size());
     for (const string_view word : words) {
-        word_to_documents_freqs_[word][document_id] += inv_word_count;  // calculating Term Frequency
-        document_id_to_word_freqs_[document_id][word] += inv_word_count;
+        term_ids.push_back(dictionary_.Intern(word));
+    }
+    sort(term_ids.begin(), term_ids.end());
+
+    vector<TermCount>& term_counts = document_data.term_counts.Mutable();
+    for (const TermId term_id : term_ids) {
+        if (term_counts.empty() || term_counts.back().term_id != term_id) {
+            term_counts.push_back({ term_id, 0 });
+        }
+        ++term_counts.back().count;
     }
+    VisitPostings([this, ordinal, &document_data](auto& postings) {
+        postings.resize(dictionary_.size());
+        for (const auto& [term_id, term_count] : document_data.term_counts) {
+            postings[term_id].Insert(ordinal, term_count, document_data.word_count);
+        }
+    });
+    document_id_to_ordinal_.emplace(document_id, ordinal);
     document_ids_.insert(document_id);
+    OnDocumentsChanged();
+    GetSearchMetrics().documents_added.Add();
 }
 
-vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus doc_status) const {
-    return FindTopDocuments(raw_query,
-        [doc_status](int document_id, DocumentStatus status, int rating)
-        { return status == doc_status; }
-    );
+void SearchServer::AddDocuments(const vector<NewDocument>& batch) {
+    AddDocuments(execution::seq, batch);
 }
-vector<Document> SearchServer::FindTopDocuments(const execution::parallel_policy policy, string_view raw_query, DocumentStatus doc_status) const {
-    return FindTopDocuments(policy, raw_query,
-        [doc_status](int document_id, DocumentStatus status, int rating)
-        { return status == doc_status; }
-    );
+
+void SearchServer::AddDocuments(execution::parallel_policy policy, const vector<NewDocument>& batch) {
+    AddDocumentBatch(policy, batch);
 }
-vector<Document> SearchServer::FindTopDocuments(const execution::sequenced_policy policy, string_view raw_query, DocumentStatus doc_status) const {
-    return FindTopDocuments(policy, raw_query,
-        [doc_status](int document_id, DocumentStatus status, int rating)
-        { return status == doc_status; }
+
+void SearchServer::AddDocuments(execution::sequenced_policy policy, const vector<NewDocument>& batch) {
+    AddDocumentBatch(policy, batch);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::AddDocumentBatch(ExecutionPolicy& policy, const vector<NewDocument>& batch) {
+    const size_t min_slice_size = 256;
+    const size_t max_slice_count = max(1u, thread::hardware_concurrency());
+
+    struct NewPosting {
+        TermId term_id;
+        uint32_t ordinal;
+        uint32_t term_count;
+        uint32_t word_count;
+    };
+
+    // Partial index of a contiguous slice of the batch with term ids of its own
+    struct Slice {
+        size_t begin;
+        size_t end;
+        TermDictionary terms;
+        vector<TermId> term_ids;  // slice term id -> id in dictionary_
+        vector<uint32_t> word_counts;
+        vector<vector<TermCount>> term_counts;
+        vector<NewPosting> postings;  // sorted by term id, then ordinal
+        vector<InvalidBatchError::Rejection> rejections;
+    };
+
+    if (batch.empty()) {
+        return;
+    }
+    const size_t slice_count = clamp(batch.size() / min_slice_size, size_t{ 1 }, max_slice_count);
+    vector<Slice> slices(slice_count);
+    for (size_t i = 0; i < slice_count; ++i) {
+        slices[i].begin = batch.size() * i / slice_count;
+        slices[i].end = batch.size() * (i + 1) / slice_count;
+    }
+
+    ForEach(
+        policy,
+        slices.begin(), slices.end(),
+        [this, &batch](Slice& slice) {
+            vector<TermId> term_ids;
+            for (size_t index = slice.begin; index < slice.end; ++index) {
+                vector<string_view> words;
+                try {
+                    words = SplitIntoWordsNoStop(batch[index].text);
+                }
+                catch (const invalid_argument& error) {
+                    slice.rejections.push_back({ index, batch[index].id, error.what() });
+                }
+
+                term_ids.clear();
+                for (const string_view word : words) {
+                    term_ids.push_back(slice.terms.Intern(word));
+                }
+                sort(term_ids.begin(), term_ids.end());
+                vector<TermCount>& term_counts = slice.term_counts.emplace_back();
+                for (const TermId term_id : term_ids) {
+                    if (term_counts.empty() || term_counts.back().term_id != term_id) {
+                        term_counts.push_back({ term_id, 0 });
+                    }
+                    ++term_counts.back().count;
+                }
+                slice.word_counts.push_back(static_cast<uint32_t>(words.size()));
+            }
+        }
     );
+
+    vector<InvalidBatchError::Rejection> rejections;
+    unordered_set<int> batch_ids;
+    for (size_t index = 0; index < batch.size(); ++index) {
+        const int document_id = batch[index].id;
+        if (document_id < 0 || document_id_to_ordinal_.count(document_id) > 0 || !batch_ids.insert(document_id).second) {
+            rejections.push_back({ index, document_id, "invalid document id"s });
+        }
+    }
+    for (Slice& slice : slices) {
+        move(slice.rejections.begin(), slice.rejections.end(), back_inserter(rejections));
+    }
+    if (!rejections.empty()) {
+        stable_sort(rejections.begin(), rejections.end(),
+            [](const InvalidBatchError::Rejection& lhs, const InvalidBatchError::Rejection& rhs) {
+                return lhs.batch_index < rhs.batch_index;
+            }
+        );
+        throw InvalidBatchError(move(rejections));
+    }
+
+    for (Slice& slice : slices) {
+        slice.term_ids.reserve(slice.terms.size());
+        for (TermId term_id = 0; term_id < slice.terms.size(); ++term_id) {
+            slice.term_ids.push_back(dictionary_.Intern(slice.terms.GetTerm(term_id)));
+        }
+    }
+
+    OnDocumentsChanged();
+    const uint32_t first_ordinal = static_cast<uint32_t>(documents_.size());
+    ForEach(
+        policy,
+        slices.begin(), slices.end(),
+        [first_ordinal](Slice& slice) {
+            // Postings are bucketed by term with a counting sort: slice terms
+            // ordered by their dictionary ids get consecutive buckets, and
+            // walking the documents in order keeps each bucket sorted by ordinal
+            vector<TermId> terms_by_id(slice.term_ids.size());
+            iota(terms_by_id.begin(), terms_by_id.end(), 0);
+            sort(terms_by_id.begin(), terms_by_id.end(),
+                [&slice](TermId lhs, TermId rhs) {
+                    return slice.term_ids[lhs] < slice.term_ids[rhs];
+                }
+            );
+            vector<size_t> bucket_offsets(slice.term_ids.size() + 1, 0);
+            for (const vector<TermCount>& term_counts : slice.term_counts) {
+                for (const TermCount& term_count : term_counts) {
+                    ++bucket_offsets[term_count.term_id];
+                }
+            }
+            size_t posting_count = 0;
+            for (const TermId term : terms_by_id) {
+                posting_count += exchange(bucket_offsets[term], posting_count);
+            }
+
+            slice.postings.resize(posting_count);
+            for (size_t i = 0; i < slice.term_counts.size(); ++i) {
+                const uint32_t ordinal = first_ordinal + static_cast<uint32_t>(slice.begin + i);
+                vector<TermCount>& term_counts = slice.term_counts[i];
+                for (TermCount& term_count : term_counts) {
+                    slice.postings[bucket_offsets[term_count.term_id]++] =
+                        { slice.term_ids[term_count.term_id], ordinal, term_count.count, slice.word_counts[i] };
+                    term_count.term_id = slice.term_ids[term_count.term_id];
+                }
+                sort(term_counts.begin(), term_counts.end(),
+                    [](const TermCount& lhs, const TermCount& rhs) {
+                        return lhs.term_id < rhs.term_id;
+                    }
+                );
+            }
+        }
+    );
+
+    for (Slice& slice : slices) {
+        for (size_t i = 0; i < slice.term_counts.size(); ++i) {
+            const NewDocument& document = batch[slice.begin + i];
+            const uint32_t ordinal = static_cast<uint32_t>(documents_.size());
+            documents_.push_back({ document.id, ComputeAverageRating(document.ratings), document.status,
+                slice.word_counts[i], FlatArray<TermCount>(move(slice.term_counts[i])) });
+            if (text_storage_mode_ == TextStorageMode::KEEP) {
+                document_texts_.Store(ordinal, document.text);
+            }
+            document_id_to_ordinal_.emplace(document.id, ordinal);
+            document_ids_.insert(document.id);
+        }
+    }
+
+    // Every term's new postings come after its old ones, so each list is only
+    // appended to, and disjoint term ranges can be filled in parallel
+    const size_t term_count = dictionary_.size();
+    const size_t term_range_count = clamp(term_count, size_t{ 1 }, 8 * max_slice_count);
+    vector<size_t> term_ranges(term_range_count);
+    iota(term_ranges.begin(), term_ranges.end(), 0);
+    VisitPostings([&](auto& postings) {
+        postings.resize(term_count);
+        ForEach(
+            policy,
+            term_ranges.begin(), term_ranges.end(),
+            [&](size_t term_range) {
+                const TermId range_begin = static_cast<TermId>(term_count * term_range / term_range_count);
+                const TermId range_end = static_cast<TermId>(term_count * (term_range + 1) / term_range_count);
+                for (const Slice& slice : slices) {
+                    auto it = lower_bound(slice.postings.begin(), slice.postings.end(), range_begin,
+                        [](const NewPosting& posting, TermId term_id) {
+                            return posting.term_id < term_id;
+                        }
+                    );
+                    for (; it != slice.postings.end() && it->term_id < range_end; ++it) {
+                        postings[it->term_id].Insert(it->ordinal, it->term_count, it->word_count);
+                    }
+                }
+            }
+        );
+    });
+    GetSearchMetrics().documents_added.Add(batch.size());
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus doc_status,
+    size_t max_result_count) const
+{
+    GetSearchMetrics().queries.Add();
+    const Query query = ParseQuery(raw_query);
+    return FindTopDocumentsCached(query, doc_status, max_result_count, [&] {
+        return FindTopDocumentsForQuery(query,
+            [doc_status](int document_id, DocumentStatus status, int rating)
+            { return status == doc_status; },
+            max_result_count
+        );
+    });
+}
+vector<Document> SearchServer::FindTopDocuments(const execution::parallel_policy policy, string_view raw_query, DocumentStatus doc_status,
+    size_t max_result_count) const
+{
+    GetSearchMetrics().queries.Add();
+    const Query query = ParseQuery(raw_query);
+    return FindTopDocumentsCached(query, doc_status, max_result_count, [&] {
+        execution::parallel_policy parallel_policy = policy;
+        return FindTopDocumentsForQuery(parallel_policy, query,
+            [doc_status](int document_id, DocumentStatus status, int rating)
+            { return status == doc_status; },
+            max_result_count
+        );
+    });
+}
+vector<Document> SearchServer::FindTopDocuments(const execution::sequenced_policy policy, string_view raw_query, DocumentStatus doc_status,
+    size_t max_result_count) const
+{
+    return FindTopDocuments(raw_query, doc_status, max_result_count);
+}
+
+template <typename Search>
+vector<Document> SearchServer::FindTopDocumentsCached(const Query& query, DocumentStatus doc_status,
+    size_t max_result_count, Search search) const
+{
+    if (result_cache_ == nullptr) {
+        return search();
+    }
+    const string key = MakeResultCacheKey(query, doc_status, max_result_count);
+    if (optional<vector<Document>> documents = result_cache_->Find(key, generation_)) {
+        return move(*documents);
+    }
+    vector<Document> documents = search();
+    result_cache_->Insert(key, generation_, documents);
+    return documents;
 }
 
+string SearchServer::MakeResultCacheKey(const Query& query, DocumentStatus doc_status, size_t max_result_count) {
+    // Words never contain control characters, so these can delimit them
+    const char word_end = '\x01';
+    const char plus_words_end = '\x02';
+
+    vector<string_view> minus_words(query.minus_words.begin(), query.minus_words.end());
+    sort(minus_words.begin(), minus_words.end());
+    minus_words.erase(unique(minus_words.begin(), minus_words.end()), minus_words.end());
+
+    string key;
+    for (const string_view word : query.plus_words) {  // sorted and unique already
+        key.append(word);
+        key.push_back(word_end);
+    }
+    key.push_back(plus_words_end);
+    for (const string_view word : minus_words) {
+        key.append(word);
+        key.push_back(word_end);
+    }
+    key.append(to_string(static_cast<int>(doc_status)));
+    key.push_back(word_end);
+    key.append(to_string(max_result_count));
+    return key;
+}
 
 std::vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
@@ -71,23 +360,100 @@ std::vector<Document> SearchServer::FindTopDocuments(const execution::sequenced_
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+future<TopDocumentsResult> SearchServer::FindTopDocumentsAsync(string raw_query, DocumentStatus doc_status,
+    QueryLimits limits, size_t max_result_count) const
+{
+    return FindTopDocumentsAsync(move(raw_query),
+        [doc_status](int document_id, DocumentStatus status, int rating)
+        { return status == doc_status; },
+        move(limits), max_result_count
+    );
+}
+
+future<TopDocumentsResult> SearchServer::FindTopDocumentsAsync(string raw_query, QueryLimits limits) const {
+    return FindTopDocumentsAsync(move(raw_query), DocumentStatus::ACTUAL, move(limits));
+}
+
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(const vector<string>& raw_queries, ThreadPool& pool) const {
+    const vector<Query> queries = PrepareQueryBatch(raw_queries, pool);
+    vector<vector<Document>> results(queries.size());
+    pool.ParallelFor(queries.size(), [this, &queries, &results](size_t i) {
+        results[i] = FindTopDocumentsPrepared(queries[i]);
+    });
+    return results;
+}
+
+vector<SearchServer::Query> SearchServer::PrepareQueryBatch(const vector<string>& raw_queries, ThreadPool& pool) const {
+    vector<Query> queries(raw_queries.size());
+    pool.ParallelFor(raw_queries.size(), [this, &raw_queries, &queries](size_t i) {
+        queries[i] = ParseQuery(raw_queries[i]);
+    });
+
+    struct BatchTerm {
+        TermId term_id;
+        double idf;  // NaN until a query needs it as a plus-word
+    };
+    unordered_map<string_view, BatchTerm> batch_terms;
+    const auto find_term = [this, &batch_terms](string_view word) -> BatchTerm& {
+        const auto [term_it, inserted] = batch_terms.try_emplace(word);
+        if (inserted) {
+            term_it->second = { dictionary_.Find(word), numeric_limits<double>::quiet_NaN() };
+        }
+        return term_it->second;
+    };
+    VisitPostings([this, &queries, &find_term](const auto& postings) {
+        RECORD_DURATION(GetSearchMetrics().term_lookup);
+        for (Query& query : queries) {
+            query.plus_term_ids.reserve(query.plus_words.size());
+            query.plus_word_idfs.reserve(query.plus_words.size());
+            for (const string_view word : query.plus_words) {
+                BatchTerm& term = find_term(word);
+                if (term.term_id != NO_TERM && isnan(term.idf)) {
+                    const size_t document_freq = GetDocumentFreq(term.term_id, postings[term.term_id].size());
+                    term.idf = idf_cache_.Get(term.term_id, [this, document_freq] { return CalcIDF(document_freq); });
+                }
+                query.plus_term_ids.push_back(term.term_id);
+                query.plus_word_idfs.push_back(term.idf);
+            }
+            query.minus_term_ids.reserve(query.minus_words.size());
+            for (const string_view word : query.minus_words) {
+                query.minus_term_ids.push_back(find_term(word).term_id);
+            }
+        }
+    });
+
+    return queries;
+}
+
+vector<Document> SearchServer::FindTopDocumentsPrepared(const Query& query) const {
+    GetSearchMetrics().queries.Add();
+    return FindTopDocumentsCached(query, DocumentStatus::ACTUAL, MAX_RESULT_DOCUMENT_COUNT, [&] {
+        return FindTopDocumentsForQuery(query,
+            [](int document_id, DocumentStatus status, int rating)
+            { return status == DocumentStatus::ACTUAL; },
+            MAX_RESULT_DOCUMENT_COUNT
+        );
+    });
+}
+
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query, int document_id) const {
+    RECORD_DURATION(GetSearchMetrics().match);
 
     if (document_ids_.count(document_id) == 0) {
         throw invalid_argument("no document with such id");
     }
     Query query = ParseQuery(raw_query);
-    const auto status = documents_.at(document_id).status;
+    const uint32_t ordinal = document_id_to_ordinal_.at(document_id);
+    const auto status = documents_[ordinal].status;
 
     const auto WordChecker =
-        [this, document_id](string_view word) {
-        const auto it = word_to_documents_freqs_.find(word);
-        return it != word_to_documents_freqs_.end() && it->second.count(document_id);
+        [this, ordinal](string_view word) {
+        return ContainsPosting(word, ordinal);
     };
 
     if (any_of(query.minus_words.begin(), query.minus_words.end(), WordChecker)) {
-        return { {}, status };
+        return { vector<string_view>{}, status };
     }
 
 
@@ -107,32 +473,36 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_vi
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::parallel_policy&,
     string_view raw_query, int document_id) const
 {
+    RECORD_DURATION(GetSearchMetrics().match);
 
     if (document_ids_.count(document_id) == 0) {
         throw invalid_argument("no document with such id");
     }
 
     Query query = ParseQuery(raw_query);
-    const auto status = documents_.at(document_id).status;
+    const uint32_t ordinal = document_id_to_ordinal_.at(document_id);
+    const auto status = documents_[ordinal].status;
 
     const auto WordChecker =
-        [this, document_id](string_view word) {
-        const auto it = word_to_documents_freqs_.find(word);
-        return it != word_to_documents_freqs_.end() && it->second.count(document_id);
+        [this, ordinal](string_view word) {
+        return ContainsPosting(word, ordinal);
     };
 
     if (any_of(execution::seq, query.minus_words.begin(), query.minus_words.end(), WordChecker)) {
-        return { {}, status };
+        return { vector<string_view>{}, status };
     }
 
 
+    // Words are never empty, so an empty view marks an unmatched one
     vector<string_view> matched_words(query.plus_words.size());
-    auto words_end = copy_if(
-        execution::par,
-        query.plus_words.begin(), query.plus_words.end(),
-        matched_words.begin(),
-        WordChecker
+    ThreadPool::GetDefault()->ParallelFor(query.plus_words.size(),
+        [&query, &matched_words, &WordChecker](size_t word_index) {
+            if (WordChecker(query.plus_words[word_index])) {
+                matched_words[word_index] = query.plus_words[word_index];
+            }
+        }
     );
+    auto words_end = remove(matched_words.begin(), matched_words.end(), string_view());
     sort(matched_words.begin(), words_end);
     words_end = unique(matched_words.begin(), words_end);
     matched_words.erase(words_end, matched_words.end());
@@ -143,22 +513,23 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const exe
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::sequenced_policy&,
     string_view raw_query, int document_id) const
 {
+    RECORD_DURATION(GetSearchMetrics().match);
 
     if (document_ids_.count(document_id) == 0) {
         throw invalid_argument("no document with such id");
     }
 
     Query query = ParseQuery(raw_query);
-    const auto status = documents_.at(document_id).status;
+    const uint32_t ordinal = document_id_to_ordinal_.at(document_id);
+    const auto status = documents_[ordinal].status;
 
     const auto WordChecker =
-        [this, document_id](string_view word) {
-        const auto it = word_to_documents_freqs_.find(word);
-        return it != word_to_documents_freqs_.end() && it->second.count(document_id);
+        [this, ordinal](string_view word) {
+        return ContainsPosting(word, ordinal);
     };
 
     if (any_of(execution::seq, query.minus_words.begin(), query.minus_words.end(), WordChecker)) {
-        return { {}, status };
+        return { vector<string_view>{}, status };
     }
 
 
@@ -177,9 +548,208 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const exe
 
 }
 
+future<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocumentAsync(string raw_query, int document_id,
+    QueryLimits limits) const
+{
+    using Result = tuple<vector<string_view>, DocumentStatus>;
+    auto promise = make_shared<std::promise<Result>>();
+    future<Result> result = promise->get_future();
+    ThreadPool::GetDefault()->Submit(
+        [this, promise, raw_query = move(raw_query), document_id, limits = move(limits)] {
+            try {
+                if (QueryInterrupt(limits).ShouldStop()) {
+                    throw QueryInterruptedError();
+                }
+                auto [words, status] = MatchDocument(raw_query, document_id);
+                // Matched words are all in the dictionary, which outlives raw_query
+                for (string_view& word : words) {
+                    word = dictionary_.GetTerm(dictionary_.Find(word));
+                }
+                promise->set_value({ move(words), status });
+            }
+            catch (...) {
+                promise->set_exception(current_exception());
+            }
+        }
+    );
+    return result;
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(string_view raw_query,
+    const vector<int>& document_ids) const
+{
+    return MatchDocuments(execution::seq, raw_query, document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(execution::parallel_policy,
+    string_view raw_query, const vector<int>& document_ids) const
+{
+    RECORD_DURATION(GetSearchMetrics().match_batch);
+
+    const vector<uint32_t> ordinals = GetOrdinals(document_ids);
+    const MatchQuery query = ResolveMatchQuery(raw_query);
+    vector<tuple<vector<string_view>, DocumentStatus>> results(ordinals.size());
+    ThreadPool::GetDefault()->ParallelFor(ordinals.size(),
+        [this, &query, &ordinals, &results](size_t index) {
+            results[index] = MatchOrdinal(query, ordinals[index]);
+        }
+    );
+    return results;
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(execution::sequenced_policy,
+    string_view raw_query, const vector<int>& document_ids) const
+{
+    RECORD_DURATION(GetSearchMetrics().match_batch);
+
+    const vector<uint32_t> ordinals = GetOrdinals(document_ids);
+    const MatchQuery query = ResolveMatchQuery(raw_query);
+    vector<tuple<vector<string_view>, DocumentStatus>> results;
+    results.reserve(ordinals.size());
+    for (const uint32_t ordinal : ordinals) {
+        results.push_back(MatchOrdinal(query, ordinal));
+    }
+    return results;
+}
+
+SearchServer::MatchQuery SearchServer::ResolveMatchQuery(string_view raw_query) const {
+    const Query query = ParseQuery(raw_query);
+    MatchQuery match_query;
+    for (const string_view word : query.plus_words) {
+        const TermId term_id = dictionary_.Find(word);
+        if (term_id != NO_TERM) {
+            match_query.plus_terms.push_back({ term_id, dictionary_.GetTerm(term_id) });
+        }
+    }
+    sort(match_query.plus_terms.begin(), match_query.plus_terms.end());
+    match_query.plus_terms.erase(unique(match_query.plus_terms.begin(), match_query.plus_terms.end()),
+        match_query.plus_terms.end());
+    for (const string_view word : query.minus_words) {
+        const TermId term_id = dictionary_.Find(word);
+        if (term_id != NO_TERM) {
+            match_query.minus_term_ids.push_back(term_id);
+        }
+    }
+    sort(match_query.minus_term_ids.begin(), match_query.minus_term_ids.end());
+    match_query.minus_term_ids.erase(unique(match_query.minus_term_ids.begin(), match_query.minus_term_ids.end()),
+        match_query.minus_term_ids.end());
+    return match_query;
+}
+
+vector<uint32_t> SearchServer::GetOrdinals(const vector<int>& document_ids) const {
+    vector<uint32_t> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+        if (ordinal_it == document_id_to_ordinal_.end()) {
+            throw invalid_argument("no document with such id");
+        }
+        ordinals.push_back(ordinal_it->second);
+    }
+    return ordinals;
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchOrdinal(const MatchQuery& query, uint32_t ordinal) const {
+    const DocumentData& document = documents_[ordinal];
+    // Each query term is searched for past the previous one, as both lists are sorted
+    const TermCount* terms_begin = document.term_counts.begin();
+    const TermCount* const terms_end = document.term_counts.end();
+    const auto has_term = [&terms_begin, terms_end](TermId term_id) {
+        terms_begin = lower_bound(terms_begin, terms_end, term_id,
+            [](const TermCount& term_count, TermId term_id) {
+                return term_count.term_id < term_id;
+            }
+        );
+        return terms_begin != terms_end && terms_begin->term_id == term_id;
+    };
+
+    for (const TermId term_id : query.minus_term_ids) {
+        if (has_term(term_id)) {
+            return { vector<string_view>{}, document.status };
+        }
+    }
+    terms_begin = document.term_counts.begin();
+    vector<string_view> matched_words;
+    for (const auto& [term_id, word] : query.plus_terms) {
+        if (has_term(term_id)) {
+            matched_words.push_back(word);
+        }
+    }
+    sort(matched_words.begin(), matched_words.end());
+    return { matched_words, document.status };
+}
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return document_ids_.size();
+}
+
+void SearchServer::SetScoringMode(ScoringMode mode) {
+    scoring_mode_ = mode;
+}
+
+ScoringMode SearchServer::GetScoringMode() const {
+    return scoring_mode_;
+}
+
+void SearchServer::SetTextStorageMode(TextStorageMode mode) {
+    text_storage_mode_ = mode;
+    if (mode == TextStorageMode::DISCARD) {
+        document_texts_.ReleaseAll();
+    }
+}
+
+TextStorageMode SearchServer::GetTextStorageMode() const {
+    return text_storage_mode_;
+}
+
+void SearchServer::SetPostingsFormat(PostingsFormat format) {
+    if (format == postings_format_) {
+        return;
+    }
+    postings_format_ = format;
+    VisitPostings([this](auto& postings) {
+        postings.resize(dictionary_.size());
+        for (uint32_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+            const DocumentData& document = documents_[ordinal];
+            for (const auto& [term_id, term_count] : document.term_counts) {
+                postings[term_id].Insert(ordinal, term_count, document.word_count);
+            }
+        }
+    });
+    if (format == PostingsFormat::COMPRESSED) {
+        postings_ = {};
+    }
+    else {
+        compressed_postings_ = {};
+    }
+}
+
+PostingsFormat SearchServer::GetPostingsFormat() const {
+    return postings_format_;
+}
+
+void SearchServer::SetResultCacheCapacity(size_t capacity) {
+    result_cache_ = capacity > 0 ? make_unique<QueryResultCache>(capacity) : nullptr;
+}
+
+size_t SearchServer::GetResultCacheCapacity() const {
+    return result_cache_ != nullptr ? result_cache_->GetCapacity() : 0;
+}
+
+QueryResultCache::Stats SearchServer::GetResultCacheStats() const {
+    return result_cache_ != nullptr ? result_cache_->GetStats() : QueryResultCache::Stats{};
+}
+
+string_view SearchServer::GetDocumentText(int document_id) const {
+    const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+    if (ordinal_it == document_id_to_ordinal_.end()) {
+        return {};
+    }
+    return document_texts_.Get(ordinal_it->second);
+}
+
+void SearchServer::CompactDocumentTexts() {
+    document_texts_.Compact();
 }
 
 std::set<int>::const_iterator SearchServer::begin() const {
@@ -193,100 +763,582 @@ std::set<int>::const_iterator SearchServer::end() const {
 
 const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
     static const map<string_view, double> empty_map = {};
-    if (document_id_to_word_freqs_.find(document_id) == document_id_to_word_freqs_.end()) {
+    const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+    if (ordinal_it == document_id_to_ordinal_.end()) {
         return empty_map;
     }
-    return document_id_to_word_freqs_.at(document_id);
+
+    lock_guard lock(*word_frequencies_mutex_);
+    const auto [cache_it, inserted] = word_frequencies_cache_.try_emplace(document_id);
+    if (inserted) {
+        const DocumentData& document = documents_[ordinal_it->second];
+        for (const auto& [term_id, term_count] : document.term_counts) {
+            cache_it->second.emplace(dictionary_.GetTerm(term_id), ComputeTermFreq(term_count, document.word_count));
+        }
+    }
+    return cache_it->second;
 }
 
 
+const FlatArray<TermCount>& SearchServer::GetTermCounts(int document_id) const {
+    static const FlatArray<TermCount> empty_term_counts;
+    const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+    if (ordinal_it == document_id_to_ordinal_.end()) {
+        return empty_term_counts;
+    }
+    return documents_[ordinal_it->second].term_counts;
+}
+
 void SearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(execution::seq, document_id);
+}
+
+void SearchServer::RemoveDocument(std::execution::parallel_policy policy, int document_id) {
+    RemoveDocumentFromIndex(policy, document_id);
+}
 
-    if (document_id_to_word_freqs_.count(document_id) == 0) {
+void SearchServer::RemoveDocument(std::execution::sequenced_policy policy, int document_id) {
+    RemoveDocumentFromIndex(policy, document_id);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::RemoveDocumentFromIndex(ExecutionPolicy& policy, int document_id) {
+    const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+    if (ordinal_it == document_id_to_ordinal_.end()) {
         return;
     }
+    MarkRemoved(ordinal_it->second);
+    OnDocumentsChanged();
+    GetSearchMetrics().documents_removed.Add();
+    if (IsSweepDue()) {
+        SweepRemovedDocuments(policy);
+    }
+}
 
-    /* { {word, TF}, {word, TF}, ... } */
-    std::vector< std::pair<std::string, double> > words_and_it_freqs((document_id_to_word_freqs_.at(document_id)).size());
-    copy((document_id_to_word_freqs_.at(document_id)).begin(),
-        (document_id_to_word_freqs_.at(document_id)).end(),
-        words_and_it_freqs.begin());
+void SearchServer::RemoveDocuments(const vector<int>& document_ids) {
+    RemoveDocuments(execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(execution::parallel_policy policy, const vector<int>& document_ids) {
+    RemoveDocumentsFromIndex(policy, document_ids);
+}
+
+void SearchServer::RemoveDocuments(execution::sequenced_policy policy, const vector<int>& document_ids) {
+    RemoveDocumentsFromIndex(policy, document_ids);
+}
 
-    std::for_each(
-        words_and_it_freqs.begin(),
-        words_and_it_freqs.end(),
-        [&](const std::pair<std::string, double>& word_freq) {
-            word_to_documents_freqs_[word_freq.first].erase(document_id);
+template <typename ExecutionPolicy>
+void SearchServer::RemoveDocumentsFromIndex(ExecutionPolicy& policy, const vector<int>& document_ids) {
+    size_t removed_count = 0;
+    for (const int document_id : document_ids) {
+        const auto ordinal_it = document_id_to_ordinal_.find(document_id);
+        if (ordinal_it != document_id_to_ordinal_.end()) {
+            MarkRemoved(ordinal_it->second);
+            ++removed_count;
         }
-    );
+    }
+    if (removed_count == 0) {
+        return;
+    }
+    OnDocumentsChanged();
+    GetSearchMetrics().documents_removed.Add(removed_count);
+    if (IsSweepDue()) {
+        SweepRemovedDocuments(policy);
+    }
+}
 
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    document_id_to_word_freqs_.erase(document_id);
+void SearchServer::CompactPostings() {
+    CompactPostings(execution::seq);
 }
 
-void SearchServer::RemoveDocument(std::execution::parallel_policy policy, int document_id) {
+void SearchServer::CompactPostings(execution::parallel_policy policy) {
+    SweepRemovedDocuments(policy);
+}
+
+void SearchServer::CompactPostings(execution::sequenced_policy policy) {
+    SweepRemovedDocuments(policy);
+}
 
-    if (document_id_to_word_freqs_.count(document_id) == 0) {
+void SearchServer::MarkRemoved(uint32_t ordinal) {
+    DocumentData& document = documents_[ordinal];
+    document.is_removed = true;
+    for (const TermCount& term_count : document.term_counts) {
+        ++removed_document_freqs_[term_count.term_id];
+    }
+    removed_ordinals_.push_back(ordinal);
+    document_texts_.Release(ordinal);
+    document_id_to_ordinal_.erase(document.id);
+    document_ids_.erase(document.id);
+    lock_guard lock(*word_frequencies_mutex_);
+    word_frequencies_cache_.erase(document.id);
+}
+
+bool SearchServer::IsSweepDue() const {
+    return removed_ordinals_.size() > (document_ids_.size() + removed_ordinals_.size()) / 4;
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::SweepRemovedDocuments(ExecutionPolicy& policy) {
+    if (removed_ordinals_.empty()) {
         return;
     }
+    sort(removed_ordinals_.begin(), removed_ordinals_.end());
+
+    // The surviving documents are renumbered densely over the removed ones, so
+    // ordinals, and everything sized by them, never outgrow the documents
+    // kept. Each term has its own postings list, so sweeping in parallel
+    // never touches shared state.
+    VisitPostings([this, &policy](auto& postings) {
+        ForEach(
+            policy,
+            postings.begin(),
+            postings.end(),
+            [this](auto& term_postings) {
+                term_postings.EraseAndRenumber(removed_ordinals_);
+            }
+        );
+        // Terms no document has any more are forgotten, their ids reused
+        vector<TermId> removed_term_ids;
+        removed_term_ids.reserve(removed_document_freqs_.size());
+        for (const auto& [term_id, removed_document_freq] : removed_document_freqs_) {
+            removed_term_ids.push_back(term_id);
+        }
+        sort(removed_term_ids.begin(), removed_term_ids.end());
+        for (const TermId term_id : removed_term_ids) {
+            if (postings[term_id].empty()) {
+                postings[term_id] = {};
+                dictionary_.Erase(term_id);
+            }
+        }
+    });
 
-    /* { {word, TF}, {word, TF}, ... } */
-    std::vector< std::pair<std::string, double> > words_and_it_freqs((document_id_to_word_freqs_.at(document_id)).size());
-    copy(policy, (document_id_to_word_freqs_.at(document_id)).begin(),
-        (document_id_to_word_freqs_.at(document_id)).end(),
-        words_and_it_freqs.begin());
+    auto removed_it = removed_ordinals_.begin();
+    uint32_t kept_count = removed_ordinals_.front();
+    for (uint32_t ordinal = kept_count; ordinal < documents_.size(); ++ordinal) {
+        if (removed_it != removed_ordinals_.end() && *removed_it == ordinal) {
+            ++removed_it;
+            continue;
+        }
+        documents_[kept_count] = move(documents_[ordinal]);
+        document_id_to_ordinal_[documents_[kept_count].id] = kept_count;
+        ++kept_count;
+    }
+    documents_.resize(kept_count);
+    document_texts_.EraseAndRenumber(removed_ordinals_);
 
-    std::for_each(
-        policy,
-        words_and_it_freqs.begin(),
-        words_and_it_freqs.end(),
-        [&](const std::pair<std::string, double>& word_freq) {
-            word_to_documents_freqs_[word_freq.first].erase(document_id);
+    removed_ordinals_.clear();
+    removed_document_freqs_.clear();
+    OnDocumentsChanged();
+}
+
+
+void SearchServer::AddDocumentsFrom(const SearchServer& source, const unordered_set<int>& skipped_ids) {
+    // The documents copied and the terms they use are settled first, so the
+    // postings are resized and the caches invalidated once for them all
+    vector<uint32_t> source_ordinals;
+    vector<TermId> term_ids(source.dictionary_.size(), NO_TERM);  // source term id -> id in dictionary_
+    for (uint32_t source_ordinal = 0; source_ordinal < source.documents_.size(); ++source_ordinal) {
+        const DocumentData& source_document = source.documents_[source_ordinal];
+        const auto source_ordinal_it = source.document_id_to_ordinal_.find(source_document.id);
+        if (source_ordinal_it == source.document_id_to_ordinal_.end() || source_ordinal_it->second != source_ordinal
+            || skipped_ids.count(source_document.id) > 0) {
+            continue;
         }
-    );
+        if (document_id_to_ordinal_.count(source_document.id) > 0) {
+            throw invalid_argument("invalid document id"s);
+        }
+        source_ordinals.push_back(source_ordinal);
+    }
+    for (const uint32_t source_ordinal : source_ordinals) {
+        for (const TermCount& term_count : source.documents_[source_ordinal].term_counts) {
+            TermId& term_id = term_ids[term_count.term_id];
+            if (term_id == NO_TERM) {
+                term_id = dictionary_.Intern(source.dictionary_.GetTerm(term_count.term_id));
+            }
+        }
+    }
+    VisitPostings([this](auto& postings) {
+        postings.resize(dictionary_.size());
+    });
+
+    for (const uint32_t source_ordinal : source_ordinals) {
+        const DocumentData& source_document = source.documents_[source_ordinal];
+        vector<TermCount> term_counts(source_document.term_counts.begin(), source_document.term_counts.end());
+        for (TermCount& term_count : term_counts) {
+            term_count.term_id = term_ids[term_count.term_id];
+        }
+        sort(term_counts.begin(), term_counts.end(),
+            [](const TermCount& lhs, const TermCount& rhs) {
+                return lhs.term_id < rhs.term_id;
+            }
+        );
 
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    document_id_to_word_freqs_.erase(document_id);
+        const uint32_t ordinal = static_cast<uint32_t>(documents_.size());
+        const DocumentData& document = documents_.emplace_back(DocumentData{ source_document.id, source_document.rating,
+            source_document.status, source_document.word_count, FlatArray<TermCount>(move(term_counts)) });
+        if (text_storage_mode_ == TextStorageMode::KEEP) {
+            document_texts_.Store(ordinal, source.document_texts_.Get(source_ordinal));
+        }
+        VisitPostings([ordinal, &document](auto& postings) {
+            for (const auto& [term_id, term_count] : document.term_counts) {
+                postings[term_id].Insert(ordinal, term_count, document.word_count);
+            }
+        });
+        document_id_to_ordinal_.emplace(document.id, ordinal);
+        document_ids_.insert(document.id);
+    }
+    OnDocumentsChanged();
 }
 
 
-void SearchServer::RemoveDocument(std::execution::sequenced_policy policy, int document_id) {
+const uint32_t SNAPSHOT_FORMAT_VERSION = 1;
+
+enum SnapshotSection : uint32_t {
+    SNAPSHOT_SETTINGS,
+    SNAPSHOT_STOP_WORDS,
+    SNAPSHOT_TERM_TEXTS,
+    SNAPSHOT_TERM_OFFSETS,
+    SNAPSHOT_DOCUMENTS,
+    SNAPSHOT_TERM_COUNTS,
+    SNAPSHOT_TERM_COUNT_OFFSETS,
+    SNAPSHOT_DOCUMENT_TEXTS,
+    SNAPSHOT_DOCUMENT_TEXT_OFFSETS,
+    SNAPSHOT_POSTINGS_MAX_TERM_FREQS,
+    // PostingsFormat::PLAIN
+    SNAPSHOT_POSTINGS_OFFSETS,
+    SNAPSHOT_POSTINGS_ORDINALS,
+    SNAPSHOT_POSTINGS_TERM_FREQS,
+    // PostingsFormat::COMPRESSED
+    SNAPSHOT_POSTINGS_SIZES,
+    SNAPSHOT_BLOCK_OFFSETS,
+    SNAPSHOT_BLOCKS,
+    SNAPSHOT_BLOCK_DATA_OFFSETS,
+    SNAPSHOT_BLOCK_DATA,
+};
+
+struct SnapshotSettings {
+    uint32_t postings_format;
+    uint32_t text_storage_mode;
+    uint32_t scoring_mode;
+    uint32_t ordinal_count;
+    uint32_t term_count;
+    uint32_t reserved;
+};
+
+struct SnapshotDocument {
+    int32_t id;
+    int32_t rating;
+    uint32_t status;
+    uint32_t word_count;
+    uint32_t is_indexed;  // 0 for the ordinals of removed documents
+    uint32_t reserved;
+};
+
+// Writes count + 1 running offsets, the boundaries of count consecutive
+// variable-length items in another section
+template <typename ItemSize>
+static void WriteOffsets(SnapshotWriter& writer, uint32_t section_id, size_t count, ItemSize item_size) {
+    writer.BeginSection(section_id);
+    uint64_t offset = 0;
+    writer.Write(offset);
+    for (size_t i = 0; i < count; ++i) {
+        offset += item_size(i);
+        writer.Write(offset);
+    }
+    writer.EndSection();
+}
 
-    if (document_id_to_word_freqs_.count(document_id) == 0) {
-        return;
+static FlatArray<uint64_t> ReadOffsets(const SnapshotReader& reader, uint32_t section_id, size_t count, size_t total_size) {
+    FlatArray<uint64_t> offsets = reader.GetSection<uint64_t>(section_id);
+    if (offsets.size() != count + 1 || offsets[0] != 0 || offsets.back() != total_size
+        || !is_sorted(offsets.begin(), offsets.end()))
+    {
+        throw runtime_error("snapshot section " + to_string(section_id) + " is damaged");
     }
+    return offsets;
+}
 
-    /* { {word, TF}, {word, TF}, ... } */
-    std::vector< std::pair<std::string, double> > words_and_it_freqs((document_id_to_word_freqs_.at(document_id)).size());
-    copy(policy, (document_id_to_word_freqs_.at(document_id)).begin(),
-        (document_id_to_word_freqs_.at(document_id)).end(),
-        words_and_it_freqs.begin());
+template <typename T>
+static FlatArray<T> BorrowRange(const FlatArray<T>& section, const FlatArray<uint64_t>& offsets, size_t index) {
+    return FlatArray<T>::Borrow(section.data() + offsets[index], offsets[index + 1] - offsets[index]);
+}
 
-    std::for_each(
-        policy,
-        words_and_it_freqs.begin(),
-        words_and_it_freqs.end(),
-        [&](const std::pair<std::string, double>& word_freq) {
-            word_to_documents_freqs_[word_freq.first].erase(document_id);
+static void WritePostings(SnapshotWriter& writer, const vector<PostingsList>& postings) {
+    WriteOffsets(writer, SNAPSHOT_POSTINGS_OFFSETS, postings.size(),
+        [&postings](size_t term_id) { return postings[term_id].size(); });
+    writer.BeginSection(SNAPSHOT_POSTINGS_ORDINALS);
+    for (const PostingsList& term_postings : postings) {
+        writer.Write(term_postings.GetOrdinals().data(), term_postings.size());
+    }
+    writer.EndSection();
+    writer.BeginSection(SNAPSHOT_POSTINGS_TERM_FREQS);
+    for (const PostingsList& term_postings : postings) {
+        writer.Write(term_postings.GetTermFreqs().data(), term_postings.size());
+    }
+    writer.EndSection();
+}
+
+static void WritePostings(SnapshotWriter& writer, const vector<CompressedPostingsList>& postings) {
+    writer.BeginSection(SNAPSHOT_POSTINGS_SIZES);
+    for (const CompressedPostingsList& term_postings : postings) {
+        writer.Write(static_cast<uint64_t>(term_postings.size()));
+    }
+    writer.EndSection();
+    WriteOffsets(writer, SNAPSHOT_BLOCK_OFFSETS, postings.size(),
+        [&postings](size_t term_id) { return postings[term_id].GetBlocks().size(); });
+    writer.BeginSection(SNAPSHOT_BLOCKS);
+    for (const CompressedPostingsList& term_postings : postings) {
+        writer.Write(term_postings.GetBlocks().data(), term_postings.GetBlocks().size());
+    }
+    writer.EndSection();
+    WriteOffsets(writer, SNAPSHOT_BLOCK_DATA_OFFSETS, postings.size(),
+        [&postings](size_t term_id) { return postings[term_id].GetData().size(); });
+    writer.BeginSection(SNAPSHOT_BLOCK_DATA);
+    for (const CompressedPostingsList& term_postings : postings) {
+        writer.Write(term_postings.GetData().data(), term_postings.GetData().size());
+    }
+    writer.EndSection();
+}
+
+static void ReadPostings(const SnapshotReader& reader, const FlatArray<double>& max_term_freqs,
+    vector<PostingsList>& postings)
+{
+    const FlatArray<uint32_t> ordinals = reader.GetSection<uint32_t>(SNAPSHOT_POSTINGS_ORDINALS);
+    const FlatArray<double> term_freqs = reader.GetSection<double>(SNAPSHOT_POSTINGS_TERM_FREQS);
+    const FlatArray<uint64_t> offsets = ReadOffsets(reader, SNAPSHOT_POSTINGS_OFFSETS, max_term_freqs.size(), ordinals.size());
+    if (term_freqs.size() != ordinals.size()) {
+        throw runtime_error("snapshot postings are damaged");
+    }
+    postings.reserve(max_term_freqs.size());
+    for (size_t term_id = 0; term_id < max_term_freqs.size(); ++term_id) {
+        postings.emplace_back(BorrowRange(ordinals, offsets, term_id), BorrowRange(term_freqs, offsets, term_id),
+            max_term_freqs[term_id]);
+    }
+}
+
+static void ReadPostings(const SnapshotReader& reader, const FlatArray<double>& max_term_freqs,
+    vector<CompressedPostingsList>& postings)
+{
+    using BlockHeader = CompressedPostingsList::BlockHeader;
+    const FlatArray<uint64_t> sizes = reader.GetSection<uint64_t>(SNAPSHOT_POSTINGS_SIZES);
+    const FlatArray<BlockHeader> blocks = reader.GetSection<BlockHeader>(SNAPSHOT_BLOCKS);
+    const FlatArray<uint8_t> data = reader.GetSection<uint8_t>(SNAPSHOT_BLOCK_DATA);
+    const FlatArray<uint64_t> block_offsets = ReadOffsets(reader, SNAPSHOT_BLOCK_OFFSETS, max_term_freqs.size(), blocks.size());
+    const FlatArray<uint64_t> data_offsets = ReadOffsets(reader, SNAPSHOT_BLOCK_DATA_OFFSETS, max_term_freqs.size(), data.size());
+    if (sizes.size() != max_term_freqs.size()) {
+        throw runtime_error("snapshot postings are damaged");
+    }
+    postings.reserve(max_term_freqs.size());
+    for (size_t term_id = 0; term_id < max_term_freqs.size(); ++term_id) {
+        postings.emplace_back(BorrowRange(blocks, block_offsets, term_id), BorrowRange(data, data_offsets, term_id),
+            sizes[term_id], max_term_freqs[term_id]);
+    }
+}
+
+void SearchServer::SaveSnapshot(const string& path) const {
+    SnapshotWriter writer(path, SNAPSHOT_FORMAT_VERSION);
+    const uint32_t ordinal_count = static_cast<uint32_t>(documents_.size());
+    const uint32_t term_count = static_cast<uint32_t>(dictionary_.size());
+
+    writer.BeginSection(SNAPSHOT_SETTINGS);
+    writer.Write(SnapshotSettings{
+        static_cast<uint32_t>(postings_format_),
+        static_cast<uint32_t>(text_storage_mode_),
+        static_cast<uint32_t>(scoring_mode_),
+        ordinal_count,
+        term_count,
+        0
+    });
+    writer.EndSection();
+
+    writer.BeginSection(SNAPSHOT_STOP_WORDS);
+    for (const string& stop_word : stop_words_) {
+        writer.Write(stop_word.data(), stop_word.size());
+        writer.Write(' ');
+    }
+    writer.EndSection();
+
+    writer.BeginSection(SNAPSHOT_TERM_TEXTS);
+    for (TermId term_id = 0; term_id < term_count; ++term_id) {
+        const string_view term = dictionary_.GetTerm(term_id);
+        writer.Write(term.data(), term.size());
+    }
+    writer.EndSection();
+    WriteOffsets(writer, SNAPSHOT_TERM_OFFSETS, term_count,
+        [this](size_t term_id) { return dictionary_.GetTerm(static_cast<TermId>(term_id)).size(); });
+
+    writer.BeginSection(SNAPSHOT_DOCUMENTS);
+    for (uint32_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        const DocumentData& document = documents_[ordinal];
+        const auto ordinal_it = document_id_to_ordinal_.find(document.id);
+        const bool is_indexed = ordinal_it != document_id_to_ordinal_.end() && ordinal_it->second == ordinal;
+        writer.Write(SnapshotDocument{
+            document.id,
+            document.rating,
+            static_cast<uint32_t>(document.status),
+            document.word_count,
+            is_indexed,
+            0
+        });
+    }
+    writer.EndSection();
+    writer.BeginSection(SNAPSHOT_TERM_COUNTS);
+    for (const DocumentData& document : documents_) {
+        writer.Write(document.term_counts.data(), document.term_counts.size());
+    }
+    writer.EndSection();
+    WriteOffsets(writer, SNAPSHOT_TERM_COUNT_OFFSETS, ordinal_count,
+        [this](size_t ordinal) { return documents_[ordinal].term_counts.size(); });
+
+    if (text_storage_mode_ == TextStorageMode::KEEP) {
+        writer.BeginSection(SNAPSHOT_DOCUMENT_TEXTS);
+        for (uint32_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+            const string_view text = document_texts_.Get(ordinal);
+            writer.Write(text.data(), text.size());
         }
-    );
+        writer.EndSection();
+        WriteOffsets(writer, SNAPSHOT_DOCUMENT_TEXT_OFFSETS, ordinal_count,
+            [this](size_t ordinal) { return document_texts_.Get(static_cast<uint32_t>(ordinal)).size(); });
+    }
+
+    VisitPostings([&writer](const auto& postings) {
+        writer.BeginSection(SNAPSHOT_POSTINGS_MAX_TERM_FREQS);
+        for (const auto& term_postings : postings) {
+            writer.Write(term_postings.GetMaxTermFreq());
+        }
+        writer.EndSection();
+        WritePostings(writer, postings);
+    });
+
+    writer.Finish();
+}
+
+void SearchServer::LoadSnapshot(const string& path, bool verify_checksum) {
+    const SnapshotReader reader(path, SNAPSHOT_FORMAT_VERSION, verify_checksum);
+    const FlatArray<SnapshotSettings> settings_section = reader.GetSection<SnapshotSettings>(SNAPSHOT_SETTINGS);
+    if (settings_section.size() != 1
+        || settings_section[0].postings_format > static_cast<uint32_t>(PostingsFormat::COMPRESSED)
+        || settings_section[0].text_storage_mode > static_cast<uint32_t>(TextStorageMode::DISCARD)
+        || settings_section[0].scoring_mode > static_cast<uint32_t>(ScoringMode::MAX_SCORE))
+    {
+        throw runtime_error(path + " has damaged settings"s);
+    }
+    const SnapshotSettings settings = settings_section[0];
+    const PostingsFormat postings_format = static_cast<PostingsFormat>(settings.postings_format);
+    const TextStorageMode text_storage_mode = static_cast<TextStorageMode>(settings.text_storage_mode);
+
+    const FlatArray<char> stop_words_text = reader.GetSection<char>(SNAPSHOT_STOP_WORDS);
+    set<string, less<>> stop_words = MakeUniqueNonEmptyStrings(
+        SplitIntoWordsView(string_view(stop_words_text.data(), stop_words_text.size())));
+
+    const FlatArray<char> term_texts = reader.GetSection<char>(SNAPSHOT_TERM_TEXTS);
+    const FlatArray<uint64_t> term_offsets = ReadOffsets(reader, SNAPSHOT_TERM_OFFSETS, settings.term_count, term_texts.size());
+    TermDictionary dictionary;
+    for (TermId term_id = 0; term_id < settings.term_count; ++term_id) {
+        const FlatArray<char> term = BorrowRange(term_texts, term_offsets, term_id);
+        if (term.empty()) {  // erased
+            dictionary.AddErased();
+        }
+        else {
+            dictionary.InternBorrowed(string_view(term.data(), term.size()));
+        }
+    }
+    dictionary.ReuseErasedIds();
+    if (dictionary.size() != settings.term_count) {
+        throw runtime_error(path + " has duplicate terms"s);
+    }
+
+    const FlatArray<SnapshotDocument> document_section = reader.GetSection<SnapshotDocument>(SNAPSHOT_DOCUMENTS);
+    const FlatArray<TermCount> term_counts = reader.GetSection<TermCount>(SNAPSHOT_TERM_COUNTS);
+    const FlatArray<uint64_t> term_count_offsets = ReadOffsets(reader, SNAPSHOT_TERM_COUNT_OFFSETS,
+        settings.ordinal_count, term_counts.size());
+    if (document_section.size() != settings.ordinal_count) {
+        throw runtime_error(path + " has damaged documents"s);
+    }
+    deque<DocumentData> documents;
+    unordered_map<int, uint32_t> document_id_to_ordinal;
+    document_id_to_ordinal.reserve(settings.ordinal_count);
+    set<int> document_ids;
+    vector<uint32_t> removed_ordinals;
+    unordered_map<TermId, uint32_t> removed_document_freqs;
+    for (uint32_t ordinal = 0; ordinal < settings.ordinal_count; ++ordinal) {
+        const SnapshotDocument& document = document_section[ordinal];
+        if (!document.is_indexed) {
+            // Removed but not swept yet, so still in the postings. Older
+            // snapshots also hold swept ones, left without terms, which the
+            // next sweep drops all the same.
+            FlatArray<TermCount> removed_term_counts = BorrowRange(term_counts, term_count_offsets, ordinal);
+            for (const TermCount& term_count : removed_term_counts) {
+                ++removed_document_freqs[term_count.term_id];
+            }
+            removed_ordinals.push_back(ordinal);
+            documents.push_back({ document.id, document.rating, static_cast<DocumentStatus>(document.status),
+                document.word_count, move(removed_term_counts), true });
+            continue;
+        }
+        if (!document_id_to_ordinal.emplace(document.id, ordinal).second) {
+            throw runtime_error(path + " has duplicate documents"s);
+        }
+        document_ids.insert(document.id);
+        documents.push_back({ document.id, document.rating, static_cast<DocumentStatus>(document.status),
+            document.word_count, BorrowRange(term_counts, term_count_offsets, ordinal) });
+    }
 
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    document_id_to_word_freqs_.erase(document_id);
+    DocumentTextStorage document_texts;
+    if (text_storage_mode == TextStorageMode::KEEP) {
+        const FlatArray<char> texts = reader.GetSection<char>(SNAPSHOT_DOCUMENT_TEXTS);
+        const FlatArray<uint64_t> text_offsets = ReadOffsets(reader, SNAPSHOT_DOCUMENT_TEXT_OFFSETS,
+            settings.ordinal_count, texts.size());
+        for (uint32_t ordinal = 0; ordinal < settings.ordinal_count; ++ordinal) {
+            const FlatArray<char> text = BorrowRange(texts, text_offsets, ordinal);
+            if (!text.empty()) {
+                document_texts.StoreBorrowed(ordinal, string_view(text.data(), text.size()));
+            }
+        }
+    }
+
+    const FlatArray<double> max_term_freqs = reader.GetSection<double>(SNAPSHOT_POSTINGS_MAX_TERM_FREQS);
+    if (max_term_freqs.size() != settings.term_count) {
+        throw runtime_error(path + " has damaged postings"s);
+    }
+    vector<PostingsList> postings;
+    vector<CompressedPostingsList> compressed_postings;
+    if (postings_format == PostingsFormat::COMPRESSED) {
+        ReadPostings(reader, max_term_freqs, compressed_postings);
+    }
+    else {
+        ReadPostings(reader, max_term_freqs, postings);
+    }
+
+    stop_words_ = move(stop_words);
+    stop_word_views_ = unordered_set<string_view>(stop_words_.begin(), stop_words_.end());
+    dictionary_ = move(dictionary);
+    postings_ = move(postings);
+    compressed_postings_ = move(compressed_postings);
+    documents_ = move(documents);
+    document_texts_ = move(document_texts);
+    document_id_to_ordinal_ = move(document_id_to_ordinal);
+    document_ids_ = move(document_ids);
+    removed_ordinals_ = move(removed_ordinals);
+    removed_document_freqs_ = move(removed_document_freqs);
+    scoring_mode_ = static_cast<ScoringMode>(settings.scoring_mode);
+    text_storage_mode_ = text_storage_mode;
+    postings_format_ = postings_format;
+    snapshot_file_ = reader.GetFile();
+    OnDocumentsChanged();
+    lock_guard lock(*word_frequencies_mutex_);
+    word_frequencies_cache_.clear();
 }
 
 
 
-bool SearchServer::IsStopWord(const std::string& word) const {
-    return stop_words_.count(word);
+bool SearchServer::IsStopWord(string_view word) const {
+    return !stop_word_views_.empty() && stop_word_views_.count(word) > 0;
 }
 
 
 
-bool SearchServer::IsValidWord(const std::string& word) {
+bool SearchServer::IsValidWord(string_view word) {
     return none_of(word.begin(), word.end(), [](char c) {
         return c >= '\0' && c < ' ';
         });
@@ -295,26 +1347,23 @@ bool SearchServer::IsValidWord(const std::string& word) {
 
 vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
     vector<string_view> words;
-    for (const string_view word : SplitIntoWordsView(text)) {
-        if (!IsValidWord(string(word))) {
-            throw invalid_argument("invalid characters");
-        }
-        if (!IsStopWord(string(word))) {
-            words.push_back(word);
-        }
+    if (!SplitIntoValidWordsView(text, words)) {
+        throw invalid_argument("invalid characters");
     }
+    words.erase(remove_if(words.begin(), words.end(),
+        [this](string_view word) { return IsStopWord(word); }), words.end());
     return words;
 }
 
 SearchServer::Query SearchServer::ParseQuery(string_view query_string_view) const {
+    RECORD_DURATION(GetSearchMetrics().parse);
     Query query;
 
-    if (!IsValidWord(string(query_string_view))) {
+    vector<string_view> query_sv_cont;
+    if (!SplitIntoValidWordsView(query_string_view, query_sv_cont)) {
         throw invalid_argument("invalid characters");
     }
 
-    vector<string_view> query_sv_cont = SplitIntoWordsView(query_string_view);
-
     for (string_view word : query_sv_cont) {
         if (word[0] == '-') {
             string_view minus_word = word.substr(1);
@@ -339,8 +1388,49 @@ SearchServer::Query SearchServer::ParseQuery(string_view query_string_view) cons
 }
 
 
-double SearchServer::CalcIDF(string_view word) const {
-    return log((1.0 * SearchServer::GetDocumentCount()) / word_to_documents_freqs_.at(word).size());
+bool SearchServer::ContainsPosting(string_view word, uint32_t ordinal) const {
+    return VisitPostings([this, word, ordinal](const auto& postings) {
+        const auto* term_postings = FindPostings(postings, word);
+        return term_postings != nullptr && term_postings->Contains(ordinal);
+    });
+}
+
+TermId SearchServer::FindPlusWord(const Query& query, size_t word_index) const {
+    if (!query.plus_term_ids.empty()) {
+        return query.plus_term_ids[word_index];
+    }
+    return dictionary_.Find(query.plus_words[word_index]);
+}
+
+TermId SearchServer::FindMinusWord(const Query& query, size_t word_index) const {
+    if (!query.minus_term_ids.empty()) {
+        return query.minus_term_ids[word_index];
+    }
+    return dictionary_.Find(query.minus_words[word_index]);
+}
+
+size_t SearchServer::GetDocumentFreq(TermId term_id, size_t postings_size) const {
+    if (removed_document_freqs_.empty()) {
+        return postings_size;
+    }
+    const auto freq_it = removed_document_freqs_.find(term_id);
+    return freq_it != removed_document_freqs_.end() ? postings_size - freq_it->second : postings_size;
+}
+
+double SearchServer::CalcIDF(size_t document_freq) const {
+    return log((1.0 * SearchServer::GetDocumentCount()) / document_freq);
+}
+
+double SearchServer::GetPlusWordIDF(const Query& query, size_t word_index, TermId term_id, size_t document_freq) const {
+    if (!query.plus_word_idfs.empty()) {
+        return query.plus_word_idfs[word_index];
+    }
+    return idf_cache_.Get(term_id, [this, document_freq] { return CalcIDF(document_freq); });
+}
+
+void SearchServer::OnDocumentsChanged() {
+    ++generation_;
+    idf_cache_.Reset(dictionary_.size());
 }
 
 
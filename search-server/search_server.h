@@ -1,12 +1,28 @@
 #pragma once
+#include "compressed_postings.h"
 #include "document.h"
+#include "document_text_storage.h"
+#include "idf_cache.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "postings.h"
+#include "query_limits.h"
+#include "query_result_cache.h"
+#include "score_accumulator.h"
 #include "string_processing.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
+#include "top_documents.h"
 
 #include <vector>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <map>
 #include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <algorithm>
@@ -14,12 +30,83 @@
 #include <execution>
 #include <chrono>
 #include <mutex>
-#include "concurrent_map.h"
+#include <limits>
+#include <numeric>
+#include <thread>
+
+const int MAX_RESULT_DOCUMENT_COUNT = 5;  // default number of documents FindTopDocuments returns
+
+// How the sequential FindTopDocuments walks the postings. Both modes return
+// the same documents, MAX_SCORE just skips the ones that provably can't make
+// it into the result.
+enum class ScoringMode {
+    EXHAUSTIVE,  // scores every posting of every plus-word
+    MAX_SCORE,   // document-at-a-time with MaxScore dynamic pruning
+};
+
+// What happens to a document's text once it is indexed.
+enum class TextStorageMode {
+    KEEP,     // packed into arenas, available through GetDocumentText
+    DISCARD,  // only the index is kept
+};
+
+// How postings lists are laid out in memory. Queries return the same results
+// in both formats.
+enum class PostingsFormat {
+    PLAIN,       // arrays of ordinals and term frequencies, the fastest to scan
+    COMPRESSED,  // variable-byte blocks with skip headers, several times smaller
+};
 
-const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const double EPSILON = 1e-6;
+// Thrown by SearchServer::AddDocuments when documents of a batch break the
+// rules AddDocument enforces. None of the batch is added then.
+class InvalidBatchError : public std::invalid_argument {
+public:
+    struct Rejection {
+        size_t batch_index;
+        int document_id;
+        std::string reason;
+    };
+
+    explicit InvalidBatchError(std::vector<Rejection> rejections);
+
+    // In batch order
+    const std::vector<Rejection>& GetRejections() const;
+
+private:
+    std::vector<Rejection> rejections_;
+};
+
+// What queries and index changes record into the MetricsRegistry
+struct SearchMetrics {
+    LatencyMetric parse{ "search.parse" };
+    LatencyMetric term_lookup{ "search.term_lookup" };
+    // Scoring, and with MAX_SCORE the top-K selection it is interleaved with
+    LatencyMetric postings_scan{ "search.postings_scan" };
+    LatencyMetric top_k{ "search.top_k" };
+    LatencyMetric match{ "search.match" };  // parse included
+    LatencyMetric match_batch{ "search.match_batch" };  // a whole MatchDocuments call
+    CounterMetric queries{ "search.queries" };
+    CounterMetric documents_added{ "index.documents_added" };
+    CounterMetric documents_removed{ "index.documents_removed" };
+};
+
+// Registered on first use
+const SearchMetrics& GetSearchMetrics();
+
+// What an asynchronous FindTopDocuments returns. A query stopped by its
+// limits returns the best documents among those it got to; their
+// relevances may lack the words it didn't get to, unless the scoring mode
+// is MAX_SCORE, which scores every document it returns in full.
+struct TopDocumentsResult {
+    std::vector<Document> documents;
+    bool is_partial = false;
+};
 
 class SearchServer {
+    friend class ConcurrentSearchServer;
+    friend void ProcessQueriesStreamed(const SearchServer& search_server, const std::vector<std::string>& queries,
+        const std::function<void(size_t, std::vector<Document>&&)>& sink, size_t window);
+
 public:
 
     explicit SearchServer(const std::string& stop_words_string);
@@ -30,37 +117,157 @@ public:
 
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& marks);
 
+    // Adds the documents in batch order, or none of them if any is rejected.
+    // The parallel version tokenizes slices of the batch on all cores into
+    // partial indexes of their own and merges them into the index in a
+    // single pass over the new terms' postings.
+    void AddDocuments(const std::vector<NewDocument>& batch);
+    void AddDocuments(std::execution::parallel_policy policy, const std::vector<NewDocument>& batch);
+    void AddDocuments(std::execution::sequenced_policy policy, const std::vector<NewDocument>& batch);
+
+    // max_result_count bounds the number of returned documents; selecting them
+    // costs O(M log max_result_count) for M matched documents. 0 returns no
+    // documents, and SIZE_MAX returns all of the matched ones.
     template <typename Predicate>
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, Predicate predicate) const;
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus doc_status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, Predicate predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus doc_status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
     template <typename Predicate>
-    std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query, Predicate predicate) const;
-    std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query, DocumentStatus doc_status) const;
+    std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query, Predicate predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query, DocumentStatus doc_status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy policy, std::string_view raw_query) const;
     template <typename Predicate>
-    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, Predicate predicate) const;
-    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, DocumentStatus doc_status) const;
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, Predicate predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, DocumentStatus doc_status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query) const;
 
+    // FindTopDocuments(raw_query) for every query of the batch, run on pool.
+    // A word several queries share is looked up and given its IDF once.
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+        ThreadPool& pool) const;
+
+    // Run on the default ThreadPool with the sequential scoring mode, and
+    // never cached. The postings scan checks limits as it goes. The server
+    // must not change while queries are pending. Errors FindTopDocuments
+    // would throw are thrown by the future's get().
+    template <typename Predicate>
+    std::future<TopDocumentsResult> FindTopDocumentsAsync(std::string raw_query, Predicate predicate,
+        QueryLimits limits = {}, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::future<TopDocumentsResult> FindTopDocumentsAsync(std::string raw_query, DocumentStatus doc_status,
+        QueryLimits limits = {}, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::future<TopDocumentsResult> FindTopDocumentsAsync(std::string raw_query, QueryLimits limits = {}) const;
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy,
         std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy,
         std::string_view raw_query, int document_id) const;
+    // Matching scans no postings, so limits are checked once, before it
+    // starts; get() throws QueryInterruptedError if they were reached then.
+    // The views point into the index, not into raw_query, and stay valid
+    // while some document has the word.
+    std::future<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocumentAsync(
+        std::string raw_query, int document_id, QueryLimits limits = {}) const;
+
+    // MatchDocument for every one of document_ids, in their order, with the
+    // query parsed and its words looked up once. A document's words are
+    // found by intersecting its forward index with the query's term ids,
+    // both sorted, so it costs O(query words * log(its words)) and probes no
+    // postings. The parallel version matches the documents on all cores.
+    // Throws std::invalid_argument for an unknown id before matching any.
+    // The views point into the index, not into raw_query, and stay valid
+    // while some document has the word.
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::execution::parallel_policy policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::execution::sequenced_policy policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
 
 
     int GetDocumentCount() const;
 
+    void SetScoringMode(ScoringMode mode);
+    ScoringMode GetScoringMode() const;
+
+    // Switching to DISCARD frees the texts stored so far.
+    void SetTextStorageMode(TextStorageMode mode);
+    TextStorageMode GetTextStorageMode() const;
+
+    // Re-encodes the postings of the documents indexed so far.
+    void SetPostingsFormat(PostingsFormat format);
+    PostingsFormat GetPostingsFormat() const;
+
+    // Keeps the results of up to capacity FindTopDocuments calls that filter
+    // by status, keyed by the normalized query, the status and the result
+    // count. Calls with a predicate of their own are never cached. Adding or
+    // removing documents invalidates the cache. 0, the default, turns it
+    // off; changing the capacity empties it.
+    void SetResultCacheCapacity(size_t capacity);
+    size_t GetResultCacheCapacity() const;
+    // All zeros while the cache is off
+    QueryResultCache::Stats GetResultCacheStats() const;
+
+    // Empty if the document is unknown or its text was not kept. The view is
+    // invalidated by RemoveDocument and CompactDocumentTexts.
+    std::string_view GetDocumentText(int document_id) const;
+
+    // Frees the space of removed documents' texts right away. RemoveDocument
+    // does it on its own once they outweigh the texts still in use.
+    void CompactDocumentTexts();
+
+    // Sweeps removed documents out of the postings right away and renumbers
+    // the rest densely, with a single pass over every postings list from the
+    // first removed ordinal on. RemoveDocument and RemoveDocuments do it on
+    // their own once removed documents make up a quarter of those in the
+    // postings. The parallel version sweeps the terms on all cores.
+    void CompactPostings();
+    void CompactPostings(std::execution::parallel_policy policy);
+    void CompactPostings(std::execution::sequenced_policy policy);
+
     std::set<int>::const_iterator begin() const;
     std::set<int>::const_iterator end() const;
 
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
+    // Forward index of the document: the term ids of its distinct words with
+    // their counts, sorted by term id. A word has the same term id in every
+    // document until the index changes. Empty for an unknown document.
+    const FlatArray<TermCount>& GetTermCounts(int document_id) const;
+
+    // Removal marks the document removed in O(its distinct words) and leaves
+    // its postings to be swept later, in batches; queries skip it and count
+    // neither it nor its words from then on.
     void RemoveDocument(int document_id);
     void RemoveDocument(std::execution::parallel_policy policy, int document_id);
     void RemoveDocument(std::execution::sequenced_policy policy, int document_id);
 
+    // Removes the documents, skipping unknown ids, and sweeps the postings at
+    // most once for all of them
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    void RemoveDocuments(std::execution::parallel_policy policy, const std::vector<int>& document_ids);
+    void RemoveDocuments(std::execution::sequenced_policy policy, const std::vector<int>& document_ids);
+
+    // Writes the stop words, the index and the documents, texts included if
+    // kept, to a file LoadSnapshot can map back. Throws std::runtime_error if
+    // the file can't be written.
+    void SaveSnapshot(const std::string& path) const;
+
+    // Replaces the contents of the server with a snapshot written by
+    // SaveSnapshot. Postings, forward index and texts are read straight from
+    // the mapped file and copied only when a change touches them, so loading
+    // costs O(terms + documents) whatever the number of postings. With
+    // verify_checksum the whole file is read once up front; without it the
+    // file's contents are trusted. Throws std::runtime_error if the file is
+    // not a valid snapshot, leaving the server unchanged.
+    void LoadSnapshot(const std::string& path, bool verify_checksum = true);
+
 private:
 
     struct QueryWord {
@@ -72,30 +279,153 @@ private:
     struct Query {
         std::deque<std::string_view> plus_words;
         std::deque<std::string_view> minus_words;
+        // Parallel to plus_words when the IDFs come from outside, as they do
+        // for a segment of a bigger index; empty means they are computed here
+        std::vector<double> plus_word_idfs;
+        // Parallel to plus_words and minus_words when the words were looked
+        // up in dictionary_ in advance, as they are for a batch of queries;
+        // empty means they are looked up here
+        std::vector<TermId> plus_term_ids;
+        std::vector<TermId> minus_term_ids;
+        // Checked by the postings scan of asynchronous queries, null otherwise
+        const QueryInterrupt* interrupt = nullptr;
+        // Whether the stages of scoring are recorded into the metrics. A
+        // ConcurrentSearchServer query runs one per segment and records its
+        // stages once for all of them.
+        bool records_stages = true;
     };
     std::set<std::string, std::less<>> stop_words_;
-
-    std::map<std::string_view, std::map<int, double>> word_to_documents_freqs_;
-    std::map<int, DocumentData> documents_;
+    // Views of stop_words_, looked up for every word indexed
+    std::unordered_set<std::string_view> stop_word_views_;
+
+    // Loaded snapshot the index may borrow data from
+    std::shared_ptr<const MappedFile> snapshot_file_;
+
+    TermDictionary dictionary_;
+    // Indexed by term id. Only the lists of postings_format_ are filled.
+    std::vector<PostingsList> postings_;
+    std::vector<CompressedPostingsList> compressed_postings_;
+    // Indexed by document ordinal. Sweeps renumber the documents kept densely,
+    // so only removed documents not swept yet leave gaps.
+    std::deque<DocumentData> documents_;
+    DocumentTextStorage document_texts_;
+    std::unordered_map<int, uint32_t> document_id_to_ordinal_;
     std::set<int> document_ids_;
-    std::map<int, std::map<std::string_view, double>> document_id_to_word_freqs_;
+    // Removed documents still in the postings, and how many of them each
+    // term's postings hold
+    std::vector<uint32_t> removed_ordinals_;
+    std::unordered_map<TermId, uint32_t> removed_document_freqs_;
+
+    // GetWordFrequencies views of the forward index, built on first request.
+    // The mutex is held by pointer so the server stays movable.
+    std::unique_ptr<std::mutex> word_frequencies_mutex_ = std::make_unique<std::mutex>();
+    mutable std::map<int, std::map<std::string_view, double>> word_frequencies_cache_;
+
+    std::unique_ptr<QueryResultCache> result_cache_;
+    uint64_t generation_ = 0;  // bumped by every change to the set of documents
+    IdfCache idf_cache_;
+
+    ScoringMode scoring_mode_ = ScoringMode::MAX_SCORE;
+    TextStorageMode text_storage_mode_ = TextStorageMode::KEEP;
+    PostingsFormat postings_format_ = PostingsFormat::PLAIN;
 
-    bool IsStopWord(const std::string& word) const;
+    bool IsStopWord(std::string_view word) const;
 
-    static bool IsValidWord(const std::string& word);
+    static bool IsValidWord(std::string_view word);
 
     std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
 
     Query ParseQuery(std::string_view query_string) const;
 
-    double CalcIDF(std::string_view word) const;
+    // Calls function with the postings lists of the current format
+    template <typename Function>
+    decltype(auto) VisitPostings(Function function);
+    template <typename Function>
+    decltype(auto) VisitPostings(Function function) const;
+
+    // nullptr if the word is not in the index
+    template <typename Postings>
+    const Postings* FindPostings(const std::vector<Postings>& postings, std::string_view word) const;
+
+    bool ContainsPosting(std::string_view word, uint32_t ordinal) const;
+
+    TermId FindPlusWord(const Query& query, size_t word_index) const;
+    TermId FindMinusWord(const Query& query, size_t word_index) const;
+
+    // Number of documents with the term, the removed ones left in its
+    // postings not counted
+    size_t GetDocumentFreq(TermId term_id, size_t postings_size) const;
+    double CalcIDF(size_t document_freq) const;
+    // From the query if it carries IDFs, from idf_cache_ otherwise
+    double GetPlusWordIDF(const Query& query, size_t word_index, TermId term_id, size_t document_freq) const;
+
+    // Invalidates what depends on the set of documents. Called by every
+    // method that changes it, once the index is updated.
+    void OnDocumentsChanged();
 
     static int ComputeAverageRating(const std::vector<int>& marks);
 
+    template <typename ExecutionPolicy>
+    void AddDocumentBatch(ExecutionPolicy& policy, const std::vector<NewDocument>& batch);
+
+    // A query resolved for matching against many documents
+    struct MatchQuery {
+        // Term ids of the plus-words in the index, ascending, each with its
+        // word; words the index lacks can't match and are left out
+        std::vector<std::pair<TermId, std::string_view>> plus_terms;
+        std::vector<TermId> minus_term_ids;  // ascending
+    };
+    MatchQuery ResolveMatchQuery(std::string_view raw_query) const;
+    // Ordinals of document_ids; throws std::invalid_argument for an unknown one
+    std::vector<uint32_t> GetOrdinals(const std::vector<int>& document_ids) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchOrdinal(const MatchQuery& query,
+        uint32_t ordinal) const;
+
+    template <typename ExecutionPolicy>
+    void RemoveDocumentFromIndex(ExecutionPolicy& policy, int document_id);
+    template <typename ExecutionPolicy>
+    void RemoveDocumentsFromIndex(ExecutionPolicy& policy, const std::vector<int>& document_ids);
+    // Marks the document removed and drops all that is kept of it besides
+    // its postings and forward index, which the sweep needs
+    void MarkRemoved(uint32_t ordinal);
+    bool IsSweepDue() const;
+    template <typename ExecutionPolicy>
+    void SweepRemovedDocuments(ExecutionPolicy& policy);
+
+    // Appends copies of the documents of source, except skipped_ids, with
+    // their terms re-interned. Stop words and settings are not copied.
+    // Throws std::invalid_argument, before copying any, if one of their ids
+    // is taken.
+    void AddDocumentsFrom(const SearchServer& source, const std::unordered_set<int>& skipped_ids);
+
+    // Parses the queries and looks every word they contain up, and gives the
+    // plus-words their IDFs, once for the whole batch
+    std::vector<Query> PrepareQueryBatch(const std::vector<std::string>& raw_queries, ThreadPool& pool) const;
+    // FindTopDocuments(raw_query) for a query of a prepared batch
+    std::vector<Document> FindTopDocumentsPrepared(const Query& query) const;
+
+    // Returns the cached result or caches what search returns
+    template <typename Search>
+    std::vector<Document> FindTopDocumentsCached(const Query& query, DocumentStatus doc_status,
+        size_t max_result_count, Search search) const;
+    static std::string MakeResultCacheKey(const Query& query, DocumentStatus doc_status, size_t max_result_count);
+
     template <typename Predicate>
-    std::vector<Document> FindAllDocuments(const Query& query, Predicate predicate) const;
+    std::vector<Document> FindTopDocumentsForQuery(const Query& query, Predicate predicate,
+        size_t max_result_count) const;
     template <typename Predicate>
-    std::vector<Document> FindAllDocuments(std::execution::parallel_policy& policy, const Query& query, Predicate predicate) const;
+    std::vector<Document> FindTopDocumentsForQuery(std::execution::parallel_policy& policy, const Query& query,
+        Predicate predicate, size_t max_result_count) const;
+
+    template <typename Postings, typename Predicate>
+    std::vector<Document> FindAllDocuments(const std::vector<Postings>& postings, const Query& query,
+        Predicate predicate) const;
+    template <typename Postings, typename Predicate>
+    std::vector<Document> FindTopDocumentsMaxScore(const std::vector<Postings>& postings, const Query& query,
+        Predicate predicate, size_t max_result_count) const;
+    template <typename Postings, typename Predicate>
+    std::vector<Document> FindTopDocumentsPartitioned(std::execution::parallel_policy& policy,
+        const std::vector<Postings>& postings, const Query& query, Predicate predicate, size_t max_result_count) const;
 
 };
 
@@ -108,136 +438,485 @@ SearchServer::SearchServer(const StringCollection& stop_words)
         using namespace std;
         throw std::invalid_argument("invalid symbols in stop words");
     }
+    stop_word_views_.insert(stop_words_.begin(), stop_words_.end());
 }
 
 template <typename Predicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, Predicate predicate) const {
-    Query query = ParseQuery(raw_query);
-    std::vector<Document> matched_documents = FindAllDocuments(query, predicate);
-
-    sort(matched_documents.begin(),
-        matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            double err = std::abs(lhs.relevance - rhs.relevance);
-            if (err < EPSILON) {
-                return lhs.rating > rhs.rating;
-            }
-            return (lhs.relevance > rhs.relevance);
-        }
-    );
-
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-
-    return matched_documents;
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, Predicate predicate,
+    size_t max_result_count) const
+{
+    GetSearchMetrics().queries.Add();
+    return FindTopDocumentsForQuery(ParseQuery(raw_query), predicate, max_result_count);
 }
 
 template <typename Predicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, Predicate predicate) const {
-    return FindTopDocuments(raw_query, predicate);
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy policy, std::string_view raw_query, Predicate predicate,
+    size_t max_result_count) const
+{
+    return FindTopDocuments(raw_query, predicate, max_result_count);
 }
 
 template <typename Predicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy policy,
     std::string_view raw_query,
-    Predicate predicate) const
+    Predicate predicate,
+    size_t max_result_count) const
 {
-    Query query = ParseQuery(raw_query);
-    std::vector<Document> matched_documents = FindAllDocuments(policy, query, predicate);
+    GetSearchMetrics().queries.Add();
+    return FindTopDocumentsForQuery(policy, ParseQuery(raw_query), predicate, max_result_count);
+}
 
-    sort(policy,
-        matched_documents.begin(),
-        matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            double err = std::abs(lhs.relevance - rhs.relevance);
-            if (err < EPSILON) {
-                return lhs.rating > rhs.rating;
+template <typename Predicate>
+std::future<TopDocumentsResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, Predicate predicate,
+    QueryLimits limits, size_t max_result_count) const
+{
+    // std::function wants a copyable task, hence the shared promise
+    auto promise = std::make_shared<std::promise<TopDocumentsResult>>();
+    std::future<TopDocumentsResult> result = promise->get_future();
+    ThreadPool::GetDefault()->Submit(
+        [this, promise, raw_query = std::move(raw_query), predicate = std::move(predicate),
+            limits = std::move(limits), max_result_count]
+        {
+            try {
+                GetSearchMetrics().queries.Add();
+                const QueryInterrupt interrupt(limits);
+                TopDocumentsResult top_documents;
+                if (!interrupt.ShouldStop()) {
+                    Query query = ParseQuery(raw_query);
+                    query.interrupt = &interrupt;
+                    top_documents.documents = FindTopDocumentsForQuery(query, predicate, max_result_count);
+                }
+                top_documents.is_partial = interrupt.IsStopped();
+                promise->set_value(std::move(top_documents));
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
             }
-            return (lhs.relevance > rhs.relevance);
         }
     );
+    return result;
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::FindTopDocumentsForQuery(const Query& query, Predicate predicate,
+    size_t max_result_count) const
+{
+    return VisitPostings([&](const auto& postings) {
+        if (scoring_mode_ == ScoringMode::MAX_SCORE) {
+            return FindTopDocumentsMaxScore(postings, query, predicate, max_result_count);
+        }
+
+        const std::vector<Document> matched_documents = FindAllDocuments(postings, query, predicate);
+        RECORD_DURATION_IF(GetSearchMetrics().top_k, query.records_stages);
+        TopDocumentsCollector top_documents(max_result_count);
+        for (const Document& document : matched_documents) {
+            top_documents.Offer(document);
+        }
+
+        return top_documents.Extract();
+    });
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::FindTopDocumentsForQuery(std::execution::parallel_policy& policy,
+    const Query& query, Predicate predicate, size_t max_result_count) const
+{
+    return VisitPostings([&](const auto& postings) {
+        return FindTopDocumentsPartitioned(policy, postings, query, predicate, max_result_count);
+    });
+}
 
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename Function>
+decltype(auto) SearchServer::VisitPostings(Function function) {
+    if (postings_format_ == PostingsFormat::COMPRESSED) {
+        return function(compressed_postings_);
     }
+    return function(postings_);
+}
 
-    return matched_documents;
+template <typename Function>
+decltype(auto) SearchServer::VisitPostings(Function function) const {
+    if (postings_format_ == PostingsFormat::COMPRESSED) {
+        return function(compressed_postings_);
+    }
+    return function(postings_);
 }
 
+template <typename Postings>
+const Postings* SearchServer::FindPostings(const std::vector<Postings>& postings, std::string_view word) const {
+    const TermId term_id = dictionary_.Find(word);
+    return term_id == NO_TERM ? nullptr : &postings[term_id];
+}
 
-template <typename Predicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, Predicate predicate) const {
 
-    std::map<int, double> doc_to_relevance;
 
-    for (std::string_view word : query.plus_words) {
-        if (word_to_documents_freqs_.count(word) == 0) {
-            continue;
+template <typename Postings, typename Predicate>
+std::vector<Document> SearchServer::FindAllDocuments(const std::vector<Postings>& postings, const Query& query,
+    Predicate predicate) const
+{
+    using State = ScoreAccumulator::State;
+
+    std::vector<const Postings*> minus_postings;
+    std::vector<std::pair<const Postings*, double>> plus_postings;  // {postings, IDF}
+    {
+        RECORD_DURATION_IF(GetSearchMetrics().term_lookup, query.records_stages);
+        for (size_t word_index = 0; word_index < query.minus_words.size(); ++word_index) {
+            const TermId term_id = FindMinusWord(query, word_index);
+            if (term_id != NO_TERM) {
+                minus_postings.push_back(&postings[term_id]);
+            }
         }
-
-        double IDF = CalcIDF(word);
-        for (const auto& [document_id, TF] : word_to_documents_freqs_.at(word)) {
-            const auto& document = documents_.at(document_id);
-            if (predicate(document_id, document.status, document.rating)) {
-                doc_to_relevance[document_id] += TF * IDF;
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const TermId term_id = FindPlusWord(query, word_index);
+            if (term_id == NO_TERM) {
+                continue;
+            }
+            const Postings& term_postings = postings[term_id];
+            const size_t document_freq = GetDocumentFreq(term_id, term_postings.size());
+            if (document_freq > 0) {
+                plus_postings.emplace_back(&term_postings, GetPlusWordIDF(query, word_index, term_id, document_freq));
             }
         }
     }
-    for (std::string_view word : query.minus_words) {
-        for (const auto& [document_id, TF] : word_to_documents_freqs_.at(word)) {
-            doc_to_relevance.erase(document_id);
+
+    RECORD_DURATION_IF(GetSearchMetrics().postings_scan, query.records_stages);
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForThisThread(documents_.size());
+    AccumulatorGuard accumulator_guard(accumulator);
+    InterruptPoller interrupt_poller(query.interrupt);
+
+    // Documents with minus-words are rejected up front, so scoring skips
+    // them instead of summing relevances only to throw them away
+    for (const Postings* term_postings : minus_postings) {
+        for (typename Postings::Cursor cursor(*term_postings); !cursor.AtEnd(); cursor.Next()) {
+            accumulator.Reject(cursor.GetOrdinal());
         }
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : doc_to_relevance) {
-        matched_documents.push_back({ document_id, relevance,
-                                    documents_.at(document_id).rating,
+    // A stopped query keeps what it has summed so far
+    for (size_t term_index = 0; term_index < plus_postings.size() && !interrupt_poller.IsStopped(); ++term_index) {
+        const auto& [term_postings, IDF] = plus_postings[term_index];
+        for (typename Postings::Cursor cursor(*term_postings); !cursor.AtEnd(); cursor.Next()) {
+            if (interrupt_poller.Poll()) {
+                break;
             }
-        );
+            const uint32_t ordinal = cursor.GetOrdinal();
+            State state = accumulator.GetState(ordinal);
+            if (state == State::UNSEEN) {
+                const DocumentData& document = documents_[ordinal];
+                if (!document.is_removed && predicate(document.id, document.status, document.rating)) {
+                    accumulator.Accept(ordinal);
+                    state = State::ACCEPTED;
+                }
+                else {
+                    accumulator.Reject(ordinal);
+                    continue;
+                }
+            }
+            if (state == State::ACCEPTED) {
+                accumulator.Add(ordinal, cursor.GetTermFreq() * IDF);
+            }
+        }
+    }
+
+    std::vector<Document> matched_documents;
+    for (const uint32_t ordinal : accumulator.GetTouched()) {
+        if (accumulator.GetState(ordinal) == State::ACCEPTED) {
+            const DocumentData& document = documents_[ordinal];
+            matched_documents.push_back({ document.id, accumulator.GetRelevance(ordinal), document.rating });
+        }
     }
 
     return matched_documents;
 }
 
-template <typename Predicate>
-std::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy& policy, const Query& query, Predicate predicate) const {
-
-    ConcurrentMap<int, double> doc_to_relevance(10);
-
-    std::for_each(
-        policy,
-        query.plus_words.begin(), query.plus_words.end(),
-        [this, predicate, &doc_to_relevance](std::string_view word) {
-            if (word_to_documents_freqs_.count(word)) {
-                double IDF = CalcIDF(word);
-                for (const auto& [document_id, TF] : word_to_documents_freqs_.at(word)) {
-                    const auto& document = documents_.at(document_id);
-                    if (predicate(document_id, document.status, document.rating)) {
-                        doc_to_relevance[document_id].ref_to_value += TF * IDF;
-                    }
-                }
+// MaxScore: terms sorted by their score upper bound (max TF * IDF) are split
+// into a "non-essential" prefix, whose bounds sum below the current top-K
+// threshold, and the essential rest. A document found only in non-essential
+// postings can't make it into the result, so candidates are produced by
+// scanning just the essential postings, window by window of ordinals, into a
+// small cache-resident accumulator. A candidate whose bound clears the
+// threshold probes the non-essential postings, highest bound first, until the
+// bound drops below it. Survivors are scored exactly by probing every term in
+// plus-word order, the order FindAllDocuments sums in, so relevances are
+// bit-identical to the exhaustive path.
+template <typename Postings, typename Predicate>
+std::vector<Document> SearchServer::FindTopDocumentsMaxScore(const std::vector<Postings>& postings,
+    const Query& query, Predicate predicate, size_t max_result_count) const
+{
+    using Cursor = typename Postings::Cursor;
+    const uint32_t window_size = 4096;
+    // Covers the EPSILON tie window of IsMoreRelevant and rounding of the bound sums
+    const double pruning_slack = 2 * EPSILON;
+
+    struct Term {
+        double idf;
+        double upper_bound;
+    };
+
+    std::vector<Term> terms;  // in plus-word order
+    std::vector<Cursor> scan_cursors;
+    std::vector<Cursor> probe_cursors;
+    std::vector<Cursor> minus_cursors;
+    {
+        RECORD_DURATION_IF(GetSearchMetrics().term_lookup, query.records_stages);
+        scan_cursors.reserve(query.plus_words.size());
+        probe_cursors.reserve(query.plus_words.size());
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const TermId term_id = FindPlusWord(query, word_index);
+            if (term_id == NO_TERM) {
+                continue;
+            }
+            const Postings& term_postings = postings[term_id];
+            const size_t document_freq = GetDocumentFreq(term_id, term_postings.size());
+            if (document_freq == 0) {
+                continue;
+            }
+            const double idf = GetPlusWordIDF(query, word_index, term_id, document_freq);
+            terms.push_back({ idf, term_postings.GetMaxTermFreq() * idf });
+            scan_cursors.emplace_back(term_postings);
+            probe_cursors.emplace_back(term_postings);
+        }
+        minus_cursors.reserve(query.minus_words.size());
+        for (size_t word_index = 0; word_index < query.minus_words.size(); ++word_index) {
+            const TermId term_id = FindMinusWord(query, word_index);
+            if (term_id != NO_TERM) {
+                minus_cursors.emplace_back(postings[term_id]);
             }
         }
+    }
+    if (max_result_count == 0 || terms.empty()) {
+        return {};
+    }
+
+    RECORD_DURATION_IF(GetSearchMetrics().postings_scan, query.records_stages);
+
+    std::vector<size_t> terms_by_bound(terms.size());
+    std::iota(terms_by_bound.begin(), terms_by_bound.end(), 0);
+    std::sort(terms_by_bound.begin(), terms_by_bound.end(),
+        [&terms](size_t lhs, size_t rhs) {
+            return terms[lhs].upper_bound < terms[rhs].upper_bound;
+        }
     );
+    std::vector<double> bound_prefix_sums(terms.size());
+    double total_bound = 0.0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        total_bound += terms[terms_by_bound[i]].upper_bound;
+        bound_prefix_sums[i] = total_bound;
+    }
 
-    std::map<int, double> doc_to_relevance_ord_map = doc_to_relevance.BuildOrdinaryMap();
+    TopDocumentsCollector top_documents(max_result_count);
+    double threshold = -std::numeric_limits<double>::infinity();
+    size_t non_essential_count = 0;
+
+    const uint32_t ordinal_count = static_cast<uint32_t>(documents_.size());
+    std::vector<double> window_scores(std::min(window_size, ordinal_count), 0.0);
+    std::vector<bool> window_touched(window_scores.size(), false);
+    std::vector<uint32_t> touched_slots;
+
+    // The smallest ordinal an essential term has left, or ordinal_count if
+    // they are all exhausted
+    const auto find_next_ordinal = [&]() {
+        uint32_t next_ordinal = ordinal_count;
+        for (size_t i = non_essential_count; i < terms.size(); ++i) {
+            const Cursor& cursor = scan_cursors[terms_by_bound[i]];
+            if (!cursor.AtEnd()) {
+                next_ordinal = std::min(next_ordinal, cursor.GetOrdinal());
+            }
+        }
+        return next_ordinal;
+    };
 
-    for (std::string_view word : query.minus_words) {
-        for (const auto& [document_id, TF] : word_to_documents_freqs_.at(word)) {
-            doc_to_relevance_ord_map.erase(document_id);
+    // Windows start at the next essential posting, so a query costs as much
+    // as its postings rather than as the ordinal space. A stopped query
+    // returns the best of the windows it has finished.
+    for (uint32_t window_begin = find_next_ordinal();
+        window_begin < ordinal_count && non_essential_count < terms.size()
+            && (query.interrupt == nullptr || !query.interrupt->ShouldStop());
+        window_begin = find_next_ordinal())
+    {
+        const uint32_t window_end = window_begin + std::min(window_size, ordinal_count - window_begin);
+        // The threshold may rise inside the window, but the split the window was scanned with stays
+        const size_t window_non_essential_count = non_essential_count;
+        const double non_essential_bound = window_non_essential_count > 0
+            ? bound_prefix_sums[window_non_essential_count - 1] : 0.0;
+
+        for (size_t i = window_non_essential_count; i < terms.size(); ++i) {
+            const size_t term_index = terms_by_bound[i];
+            Cursor& cursor = scan_cursors[term_index];
+            for (cursor.SeekTo(window_begin); !cursor.AtEnd() && cursor.GetOrdinal() < window_end; cursor.Next()) {
+                const uint32_t slot = cursor.GetOrdinal() - window_begin;
+                if (!window_touched[slot]) {
+                    window_touched[slot] = true;
+                    touched_slots.push_back(slot);
+                }
+                window_scores[slot] += cursor.GetTermFreq() * terms[term_index].idf;
+            }
         }
+        // Candidates go in ordinal order, as the probing cursors only move forward
+        std::sort(touched_slots.begin(), touched_slots.end());
+
+        for (const uint32_t slot : touched_slots) {
+            const double score_bound = window_scores[slot] + non_essential_bound;
+            window_touched[slot] = false;
+            window_scores[slot] = 0.0;
+            if (score_bound < threshold - pruning_slack) {
+                continue;
+            }
+
+            const uint32_t ordinal = window_begin + slot;
+            const bool is_excluded = std::any_of(minus_cursors.begin(), minus_cursors.end(),
+                [ordinal](Cursor& minus_cursor) {
+                    minus_cursor.SeekTo(ordinal);
+                    return !minus_cursor.AtEnd() && minus_cursor.GetOrdinal() == ordinal;
+                }
+            );
+            const DocumentData& document = documents_[ordinal];
+            if (is_excluded || document.is_removed || !predicate(document.id, document.status, document.rating)) {
+                continue;
+            }
+
+            double refined_bound = score_bound;
+            for (size_t i = window_non_essential_count; i > 0 && refined_bound >= threshold - pruning_slack; --i) {
+                const size_t term_index = terms_by_bound[i - 1];
+                Cursor& cursor = scan_cursors[term_index];
+                refined_bound -= terms[term_index].upper_bound;
+                cursor.SeekTo(ordinal);
+                if (!cursor.AtEnd() && cursor.GetOrdinal() == ordinal) {
+                    refined_bound += cursor.GetTermFreq() * terms[term_index].idf;
+                }
+            }
+            if (refined_bound < threshold - pruning_slack) {
+                continue;
+            }
+
+            double relevance = 0.0;
+            for (size_t term_index = 0; term_index < terms.size(); ++term_index) {
+                Cursor& cursor = probe_cursors[term_index];
+                cursor.SeekTo(ordinal);
+                if (!cursor.AtEnd() && cursor.GetOrdinal() == ordinal) {
+                    relevance += cursor.GetTermFreq() * terms[term_index].idf;
+                }
+            }
+
+            top_documents.Offer({ document.id, relevance, document.rating });
+            if (top_documents.IsFull()) {
+                threshold = top_documents.GetWorst().relevance;
+                while (non_essential_count < terms.size()
+                    && bound_prefix_sums[non_essential_count] < threshold - pruning_slack) {
+                    ++non_essential_count;
+                }
+            }
+        }
+        touched_slots.clear();
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : doc_to_relevance_ord_map) {
-        matched_documents.push_back({ document_id, relevance,
-                                    documents_.at(document_id).rating,
+    return top_documents.Extract();
+}
+
+// The ordinal space is cut into contiguous ranges, one task per range. A task
+// scans only its slice of every postings list into its own thread's
+// accumulator and keeps a local top-K, so workers share nothing but read-only
+// index data and the per-range results are merged at the end.
+template <typename Postings, typename Predicate>
+std::vector<Document> SearchServer::FindTopDocumentsPartitioned(std::execution::parallel_policy& policy,
+    const std::vector<Postings>& postings, const Query& query, Predicate predicate, size_t max_result_count) const
+{
+    using State = ScoreAccumulator::State;
+    using Cursor = typename Postings::Cursor;
+    const uint32_t min_partition_size = 4096;
+
+    std::vector<std::pair<const Postings*, double>> plus_postings;  // {postings, IDF}
+    std::vector<const Postings*> minus_postings;
+    {
+        RECORD_DURATION_IF(GetSearchMetrics().term_lookup, query.records_stages);
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index) {
+            const TermId term_id = FindPlusWord(query, word_index);
+            if (term_id == NO_TERM) {
+                continue;
+            }
+            const Postings& term_postings = postings[term_id];
+            const size_t document_freq = GetDocumentFreq(term_id, term_postings.size());
+            if (document_freq > 0) {
+                plus_postings.emplace_back(&term_postings, GetPlusWordIDF(query, word_index, term_id, document_freq));
+            }
+        }
+        for (size_t word_index = 0; word_index < query.minus_words.size(); ++word_index) {
+            const TermId term_id = FindMinusWord(query, word_index);
+            if (term_id != NO_TERM) {
+                minus_postings.push_back(&postings[term_id]);
+            }
+        }
+    }
+
+    const std::shared_ptr<ThreadPool> pool = ThreadPool::GetDefault();
+    const uint32_t ordinal_count = static_cast<uint32_t>(documents_.size());
+    const uint32_t max_partition_count = static_cast<uint32_t>(pool->GetThreadCount());
+    const uint32_t partition_count = std::clamp(ordinal_count / min_partition_size, 1u, max_partition_count);
+    const uint32_t partition_size = ordinal_count / partition_count + 1;
+
+    std::vector<std::vector<Document>> partition_results(partition_count);
+    {
+        RECORD_DURATION_IF(GetSearchMetrics().postings_scan, query.records_stages);
+        pool->ParallelFor(
+            partition_count,
+            [&](uint32_t partition) {
+                const uint32_t range_begin = partition * partition_size;
+                const uint32_t range_end = std::min(ordinal_count, range_begin + partition_size);
+
+                ScoreAccumulator& accumulator = ScoreAccumulator::ForThisThread(ordinal_count);
+                AccumulatorGuard accumulator_guard(accumulator);
+                InterruptPoller interrupt_poller(query.interrupt);
+
+                for (const Postings* term_postings : minus_postings) {
+                    Cursor cursor(*term_postings);
+                    for (cursor.SeekTo(range_begin); !cursor.AtEnd() && cursor.GetOrdinal() < range_end; cursor.Next()) {
+                        accumulator.Reject(cursor.GetOrdinal());
+                    }
+                }
+
+                for (const auto& [term_postings, IDF] : plus_postings) {
+                    Cursor cursor(*term_postings);
+                    for (cursor.SeekTo(range_begin); !cursor.AtEnd() && cursor.GetOrdinal() < range_end; cursor.Next()) {
+                        if (interrupt_poller.Poll()) {
+                            break;
+                        }
+                        const uint32_t ordinal = cursor.GetOrdinal();
+                        State state = accumulator.GetState(ordinal);
+                        if (state == State::UNSEEN) {
+                            const DocumentData& document = documents_[ordinal];
+                            if (!document.is_removed && predicate(document.id, document.status, document.rating)) {
+                                accumulator.Accept(ordinal);
+                                state = State::ACCEPTED;
+                            }
+                            else {
+                                accumulator.Reject(ordinal);
+                                continue;
+                            }
+                        }
+                        if (state == State::ACCEPTED) {
+                            accumulator.Add(ordinal, cursor.GetTermFreq() * IDF);
+                        }
+                    }
+                }
+
+                TopDocumentsCollector top_documents(max_result_count);
+                for (const uint32_t ordinal : accumulator.GetTouched()) {
+                    if (accumulator.GetState(ordinal) == State::ACCEPTED) {
+                        const DocumentData& document = documents_[ordinal];
+                        top_documents.Offer({ document.id, accumulator.GetRelevance(ordinal), document.rating });
+                    }
+                }
+                partition_results[partition] = top_documents.Extract();
             }
         );
     }
 
-    return matched_documents;
+    RECORD_DURATION_IF(GetSearchMetrics().top_k, query.records_stages);
+    TopDocumentsCollector top_documents(max_result_count);
+    for (const std::vector<Document>& documents : partition_results) {
+        for (const Document& document : documents) {
+            top_documents.Offer(document);
+        }
+    }
+    return top_documents.Extract();
 }
-
@@ -0,0 +1,187 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+using namespace std;
+
+const char SNAPSHOT_MAGIC[8] = { 'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+const size_t SNAPSHOT_ALIGNMENT = 8;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t format_version;
+    uint64_t file_size;
+    uint64_t contents_offset;  // of the table of contents
+    uint64_t section_count;
+    uint64_t checksum;         // of everything after the header
+};
+
+struct SnapshotSectionEntry {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+void SnapshotChecksum::Update(const void* data, size_t size) {
+    if (size == 0) {  // data may be null then, as it is for an erased term
+        return;
+    }
+    const char* bytes = static_cast<const char*>(data);
+    if (pending_size_ > 0) {
+        const size_t taken = min(size, sizeof(pending_) - pending_size_);
+        memcpy(pending_ + pending_size_, bytes, taken);
+        pending_size_ += taken;
+        bytes += taken;
+        size -= taken;
+        if (pending_size_ < sizeof(pending_)) {
+            return;
+        }
+        Mix(pending_);
+        pending_size_ = 0;
+    }
+    for (; size >= sizeof(pending_); bytes += sizeof(pending_), size -= sizeof(pending_)) {
+        Mix(bytes);
+    }
+    memcpy(pending_, bytes, size);
+    pending_size_ = size;
+}
+
+uint64_t SnapshotChecksum::Get() const {
+    SnapshotChecksum checksum = *this;
+    if (checksum.pending_size_ > 0) {
+        fill(checksum.pending_ + checksum.pending_size_, end(checksum.pending_), '\0');
+        checksum.Mix(checksum.pending_);
+    }
+    return checksum.hash_;
+}
+
+void SnapshotChecksum::Mix(const char* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash_ = (hash_ ^ word) * 1099511628211ull;
+    hash_ ^= hash_ >> 32;
+}
+
+SnapshotWriter::SnapshotWriter(const string& path, uint32_t format_version)
+    : path_(path)
+    , temporary_path_(path + ".tmp")
+    , format_version_(format_version)
+    , out_(temporary_path_, ios::binary | ios::trunc)
+{
+    if (!out_) {
+        throw runtime_error("cannot create "s + temporary_path_);
+    }
+    const SnapshotHeader placeholder = {};
+    out_.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+    offset_ = sizeof(placeholder);
+}
+
+void SnapshotWriter::BeginSection(uint32_t section_id) {
+    PadToAlignment();
+    sections_.push_back({ section_id, 0, offset_, 0 });
+}
+
+void SnapshotWriter::EndSection() {
+    sections_.back().size = offset_ - sections_.back().offset;
+}
+
+void SnapshotWriter::Finish() {
+    PadToAlignment();
+    SnapshotHeader header = {};
+    copy(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC), header.magic);
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.format_version = format_version_;
+    header.contents_offset = offset_;
+    header.section_count = sections_.size();
+    for (const SectionEntry& section : sections_) {
+        const SnapshotSectionEntry entry = { section.id, 0, section.offset, section.size };
+        WriteBytes(&entry, sizeof(entry));
+    }
+    header.file_size = offset_;
+    header.checksum = checksum_.Get();
+
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out_.close();
+    if (!out_) {
+        throw runtime_error("cannot write "s + temporary_path_);
+    }
+    filesystem::rename(temporary_path_, path_);
+}
+
+void SnapshotWriter::WriteBytes(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), size);
+    if (!out_) {
+        throw runtime_error("cannot write "s + temporary_path_);
+    }
+    checksum_.Update(data, size);
+    offset_ += size;
+}
+
+void SnapshotWriter::PadToAlignment() {
+    const char padding[SNAPSHOT_ALIGNMENT] = {};
+    WriteBytes(padding, (SNAPSHOT_ALIGNMENT - offset_ % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT);
+}
+
+SnapshotReader::SnapshotReader(const string& path, uint32_t format_version, bool verify_checksum)
+    : file_(make_shared<MappedFile>(path))
+{
+    const char* data = file_->data();
+    const size_t size = file_->size();
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        throw runtime_error(path + " is not a snapshot"s);
+    }
+    memcpy(&header, data, sizeof(header));
+    if (!equal(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC), header.magic)) {
+        throw runtime_error(path + " is not a snapshot"s);
+    }
+    if (header.byte_order != SNAPSHOT_BYTE_ORDER || header.format_version != format_version) {
+        throw runtime_error(path + " was written by an incompatible version or platform"s);
+    }
+    if (header.file_size != size || header.contents_offset > size
+        || (size - header.contents_offset) / sizeof(SnapshotSectionEntry) != header.section_count)
+    {
+        throw runtime_error(path + " is truncated"s);
+    }
+    if (verify_checksum) {
+        SnapshotChecksum checksum;
+        checksum.Update(data + sizeof(header), size - sizeof(header));
+        if (checksum.Get() != header.checksum) {
+            throw runtime_error(path + " is damaged: checksum mismatch"s);
+        }
+    }
+
+    for (size_t i = 0; i < header.section_count; ++i) {
+        SnapshotSectionEntry entry;
+        memcpy(&entry, data + header.contents_offset + i * sizeof(entry), sizeof(entry));
+        if (entry.offset % SNAPSHOT_ALIGNMENT != 0 || entry.offset > header.contents_offset
+            || entry.size > header.contents_offset - entry.offset)
+        {
+            throw runtime_error(path + " is damaged: bad table of contents"s);
+        }
+        sections_.push_back({ entry.id, data + entry.offset, static_cast<size_t>(entry.size) });
+    }
+}
+
+bool SnapshotReader::HasSection(uint32_t section_id) const {
+    return FindSection(section_id) != nullptr;
+}
+
+shared_ptr<const MappedFile> SnapshotReader::GetFile() const {
+    return file_;
+}
+
+const SnapshotReader::Section* SnapshotReader::FindSection(uint32_t section_id) const {
+    const auto it = find_if(sections_.begin(), sections_.end(),
+        [section_id](const Section& section) {
+            return section.id == section_id;
+        }
+    );
+    return it == sections_.end() ? nullptr : &*it;
+}
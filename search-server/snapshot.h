@@ -0,0 +1,127 @@
+#pragma once
+#include "flat_array.h"
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// A snapshot file is a header followed by sections of raw trivially copyable
+// data, each identified by a number and aligned to 8 bytes, and a table of
+// contents at the end. The header carries a format version, the byte order of
+// the machine that wrote the file and a checksum of everything after the
+// header, so a file from an incompatible build or a damaged one is rejected
+// instead of being read as garbage.
+
+// 64-bit checksum fed with bytes in any chunks; the result only depends on
+// the bytes themselves.
+class SnapshotChecksum {
+public:
+    void Update(const void* data, size_t size);
+    uint64_t Get() const;
+
+private:
+    // Folds in 8 bytes
+    void Mix(const char* bytes);
+
+    uint64_t hash_ = 14695981039346656037ull;
+    char pending_[8] = {};
+    size_t pending_size_ = 0;
+};
+
+// Streams a snapshot to disk. The file is written under a temporary name and
+// renamed to path by Finish, so an interrupted save never replaces a good
+// snapshot with a truncated one. Throws std::runtime_error on I/O errors.
+class SnapshotWriter {
+public:
+    SnapshotWriter(const std::string& path, uint32_t format_version);
+
+    void BeginSection(uint32_t section_id);
+
+    template <typename T>
+    void Write(const T* data, size_t count);
+    template <typename T>
+    void Write(const T& value);
+
+    void EndSection();
+
+    void Finish();
+
+private:
+    struct SectionEntry {
+        uint32_t id;
+        uint32_t reserved;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    void WriteBytes(const void* data, size_t size);
+    void PadToAlignment();
+
+    std::string path_;
+    std::string temporary_path_;
+    uint32_t format_version_;
+    std::ofstream out_;
+    uint64_t offset_ = 0;
+    SnapshotChecksum checksum_;
+    std::vector<SectionEntry> sections_;
+};
+
+// Maps a snapshot file and hands out its sections as arrays borrowed from the
+// mapping. Throws std::runtime_error if the file can't be mapped, isn't a
+// snapshot of format_version or, when verify_checksum is set, is damaged.
+// Verifying reads the whole file; without it only the header and the table of
+// contents are looked at.
+class SnapshotReader {
+public:
+    SnapshotReader(const std::string& path, uint32_t format_version, bool verify_checksum);
+
+    bool HasSection(uint32_t section_id) const;
+
+    // Throws std::runtime_error if the section is missing or its size isn't
+    // a multiple of sizeof(T)
+    template <typename T>
+    FlatArray<T> GetSection(uint32_t section_id) const;
+
+    // The arrays returned by GetSection stay valid while this is alive
+    std::shared_ptr<const MappedFile> GetFile() const;
+
+private:
+    struct Section {
+        uint32_t id;
+        const char* data;
+        size_t size;
+    };
+
+    const Section* FindSection(uint32_t section_id) const;
+
+    std::shared_ptr<const MappedFile> file_;
+    std::vector<Section> sections_;
+};
+
+
+template <typename T>
+void SnapshotWriter::Write(const T* data, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable data can be written");
+    WriteBytes(data, count * sizeof(T));
+}
+
+template <typename T>
+void SnapshotWriter::Write(const T& value) {
+    Write(&value, 1);
+}
+
+template <typename T>
+FlatArray<T> SnapshotReader::GetSection(uint32_t section_id) const {
+    static_assert(alignof(T) <= 8, "sections are only aligned to 8 bytes");
+    const Section* section = FindSection(section_id);
+    if (section == nullptr || section->size % sizeof(T) != 0) {
+        throw std::runtime_error("snapshot section " + std::to_string(section_id) + " is missing or damaged");
+    }
+    return FlatArray<T>::Borrow(reinterpret_cast<const T*>(section->data), section->size / sizeof(T));
+}
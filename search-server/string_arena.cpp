@@ -0,0 +1,60 @@
+#include "string_arena.h"
+
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+StringArena::StringArena(size_t block_size)
+    : block_size_(block_size)
+{
+}
+
+StringArena::StringArena(StringArena&& other) noexcept
+    : block_size_(other.block_size_)
+    , blocks_(move(other.blocks_))
+    , free_begin_(exchange(other.free_begin_, nullptr))
+    , free_size_(exchange(other.free_size_, 0))
+    , allocated_bytes_(exchange(other.allocated_bytes_, 0))
+{
+}
+
+StringArena& StringArena::operator=(StringArena&& other) noexcept {
+    if (this != &other) {
+        block_size_ = other.block_size_;
+        blocks_ = move(other.blocks_);
+        free_begin_ = exchange(other.free_begin_, nullptr);
+        free_size_ = exchange(other.free_size_, 0);
+        allocated_bytes_ = exchange(other.allocated_bytes_, 0);
+    }
+    return *this;
+}
+
+string_view StringArena::Copy(string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    // Blocks are left uninitialized, so untouched tails cost no resident memory
+    if (text.size() > block_size_) {
+        // Oversized strings get a block of their own, the current block stays open
+        blocks_.emplace_back(new char[text.size()]);
+        allocated_bytes_ += text.size();
+        memcpy(blocks_.back().get(), text.data(), text.size());
+        return { blocks_.back().get(), text.size() };
+    }
+    if (text.size() > free_size_) {
+        blocks_.emplace_back(new char[block_size_]);
+        allocated_bytes_ += block_size_;
+        free_begin_ = blocks_.back().get();
+        free_size_ = block_size_;
+    }
+    memcpy(free_begin_, text.data(), text.size());
+    const string_view stored(free_begin_, text.size());
+    free_begin_ += text.size();
+    free_size_ -= text.size();
+    return stored;
+}
+
+size_t StringArena::GetAllocatedBytes() const {
+    return allocated_bytes_;
+}
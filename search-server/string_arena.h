@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only storage for many small strings. Text is copied back to back into
+// large blocks, so storing a string costs a memcpy instead of a heap
+// allocation of its own, and the returned views stay valid until the arena is
+// destroyed: blocks are never reallocated or freed one by one.
+class StringArena {
+public:
+    explicit StringArena(size_t block_size);
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+    StringArena(StringArena&& other) noexcept;
+    StringArena& operator=(StringArena&& other) noexcept;
+
+    std::string_view Copy(std::string_view text);
+
+    size_t GetAllocatedBytes() const;
+
+private:
+    size_t block_size_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* free_begin_ = nullptr;
+    size_t free_size_ = 0;
+    size_t allocated_bytes_ = 0;
+};
@@ -1,35 +1,132 @@
 #include "string_processing.h"
-#include <iostream>
-#include <algorithm>
-#include <execution>
-#include <sstream>
+#include <cstdint>
 #include <string_view>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SEARCH_SERVER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEARCH_SERVER_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using namespace std;
 
-vector<string_view> SplitIntoWordsView(const string_view str) {
-    vector<string_view> result;
-    int64_t pos = 0;
-    int64_t last_symb_pos = str.length();
-    const int64_t pos_end = str.npos;
-    while (true) {
-        int64_t space = str.find(' ', pos);
-        if (pos == last_symb_pos && space == pos_end) {
-            break;
+static bool IsControlCharacter(char c) {
+    return static_cast<unsigned char>(c) < ' ';
+}
+
+#if defined(SEARCH_SERVER_AVX2) || defined(SEARCH_SERVER_SSE2)
+
+static int CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+#if defined(SEARCH_SERVER_AVX2)
+const size_t CHUNK_SIZE = 32;
+
+// Bit i of space_mask is set if chunk[i] is a space, of control_mask if it
+// is a control character
+static void ClassifyChunk(const char* chunk, uint32_t& space_mask, uint32_t& control_mask) {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk));
+    const __m256i spaces = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    // Unsigned bytes <= 0x1F are the ones min(byte, 0x1F) leaves unchanged
+    const __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, _mm256_set1_epi8(0x1F)), bytes);
+    space_mask = static_cast<uint32_t>(_mm256_movemask_epi8(spaces));
+    control_mask = static_cast<uint32_t>(_mm256_movemask_epi8(controls));
+}
+#else
+const size_t CHUNK_SIZE = 16;
+
+static void ClassifyChunk(const char* chunk, uint32_t& space_mask, uint32_t& control_mask) {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chunk));
+    const __m128i spaces = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(0x1F)), bytes);
+    space_mask = static_cast<uint32_t>(_mm_movemask_epi8(spaces));
+    control_mask = static_cast<uint32_t>(_mm_movemask_epi8(controls));
+}
+#endif
+
+#endif
+
+// Splits text on spaces, a chunk of bytes per step where SIMD is available:
+// the chunk's space mask gives the positions where words begin (a non-space
+// after a space) and end (a space after a non-space), which are taken in
+// order off the mask. The bytes past the last whole chunk go one at a time.
+static bool SplitWords(string_view text, vector<string_view>& words, bool validate) {
+    const char* const data = text.data();
+    const size_t size = text.size();
+    size_t word_begin = 0;
+    bool is_in_word = false;
+    size_t pos = 0;
+
+#if defined(SEARCH_SERVER_AVX2) || defined(SEARCH_SERVER_SSE2)
+    const uint32_t chunk_bits = CHUNK_SIZE == 32 ? ~uint32_t{ 0 } : (uint32_t{ 1 } << CHUNK_SIZE) - 1;
+    for (; pos + CHUNK_SIZE <= size; pos += CHUNK_SIZE) {
+        uint32_t space_mask;
+        uint32_t control_mask;
+        ClassifyChunk(data + pos, space_mask, control_mask);
+        if (validate && control_mask != 0) {
+            return false;
         }
-        if (space == pos) {
-            pos++;
-            continue;
+        const uint32_t word_mask = ~space_mask & chunk_bits;
+        // Bit 0 compares with the last byte of the previous chunk
+        const uint32_t previous_word_mask = (word_mask << 1) | (is_in_word ? 1u : 0u);
+        // Word beginnings and ends alternate, so one mask holds them both
+        uint32_t boundary_mask = (word_mask ^ previous_word_mask) & chunk_bits;
+        while (boundary_mask != 0) {
+            const size_t boundary = pos + CountTrailingZeros(boundary_mask);
+            boundary_mask &= boundary_mask - 1;
+            if (is_in_word) {
+                words.emplace_back(data + word_begin, boundary - word_begin);
+            }
+            else {
+                word_begin = boundary;
+            }
+            is_in_word = !is_in_word;
+        }
+    }
+#endif
+
+    for (; pos < size; ++pos) {
+        const char c = data[pos];
+        if (validate && IsControlCharacter(c)) {
+            return false;
         }
-        result.push_back(space == pos_end ? str.substr(pos) : str.substr(pos, space - pos));
-        if (space == pos_end) {
-            break;
+        if (c == ' ') {
+            if (is_in_word) {
+                words.emplace_back(data + word_begin, pos - word_begin);
+                is_in_word = false;
+            }
         }
-        else {
-            pos = space + 1;
+        else if (!is_in_word) {
+            word_begin = pos;
+            is_in_word = true;
         }
     }
+    if (is_in_word) {
+        words.emplace_back(data + word_begin, size - word_begin);
+    }
+    return true;
+}
 
+vector<string_view> SplitIntoWordsView(const string_view str) {
+    vector<string_view> result;
+    SplitWords(str, result, false);
     return result;
 }
+
+bool SplitIntoValidWordsView(string_view text, vector<string_view>& words) {
+    return SplitWords(text, words, true);
+}
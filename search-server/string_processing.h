@@ -4,8 +4,14 @@
 #include <set>
 #include <string_view>
 
+// Words of text, which are separated by spaces. Views into text.
 std::vector<std::string_view> SplitIntoWordsView(const std::string_view text_sv);
 
+// Like SplitIntoWordsView, but also checks in the same pass that text has no
+// control characters. Returns false, with words incomplete, if it has.
+// Words are appended to words, so its capacity can be reused.
+bool SplitIntoValidWordsView(std::string_view text, std::vector<std::string_view>& words);
+
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
 	std::set<std::string, std::less<>> non_empty_strings;
@@ -15,4 +21,4 @@ std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContain
 		}
 	}
 	return non_empty_strings;
-}
\ No newline at end of file
+}
@@ -0,0 +1,173 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+TermDictionary::TermDictionary()
+    : arena_(ARENA_BLOCK_SIZE)
+{
+}
+
+TermDictionary::TermDictionary(const TermDictionary& other)
+    : arena_(ARENA_BLOCK_SIZE)
+{
+    terms_.reserve(other.terms_.size());
+    for (const string_view term : other.terms_) {
+        terms_.push_back(term.empty() ? term : arena_.Copy(term));
+    }
+    term_hashes_ = other.term_hashes_;
+    is_borrowed_.assign(terms_.size(), false);
+    slots_ = other.slots_;
+    erased_ids_ = other.erased_ids_;
+}
+
+TermDictionary& TermDictionary::operator=(const TermDictionary& other) {
+    if (this != &other) {
+        TermDictionary copy(other);
+        *this = move(copy);
+    }
+    return *this;
+}
+
+TermId TermDictionary::Find(string_view term) const {
+    if (slots_.empty()) {
+        return NO_TERM;
+    }
+    return slots_[FindSlot(term, hash<string_view>{}(term))];
+}
+
+TermId TermDictionary::Intern(string_view term) {
+    return Insert(term, true);
+}
+
+TermId TermDictionary::InternBorrowed(string_view term) {
+    return Insert(term, false);
+}
+
+void TermDictionary::Erase(TermId term_id) {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = FindSlot(terms_[term_id], term_hashes_[term_id]);
+    slots_[slot] = NO_TERM;
+    // Backward-shift deletion: a later term of the probe run moves into the
+    // hole unless the hole lies before its home slot, so no run is broken
+    for (size_t next = (slot + 1) & mask; slots_[next] != NO_TERM; next = (next + 1) & mask) {
+        const size_t home = term_hashes_[slots_[next]] & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            slots_[slot] = exchange(slots_[next], NO_TERM);
+            slot = next;
+        }
+    }
+    if (!is_borrowed_[term_id] && !terms_[term_id].empty()) {
+        // The arena's blocks are writable, only the views are const
+        free_spans_[terms_[term_id].size()].push_back(const_cast<char*>(terms_[term_id].data()));
+    }
+    terms_[term_id] = {};
+    is_borrowed_[term_id] = false;
+    erased_ids_.push_back(term_id);
+}
+
+TermId TermDictionary::AddErased() {
+    const TermId term_id = static_cast<TermId>(terms_.size());
+    terms_.emplace_back();
+    term_hashes_.push_back(0);
+    is_borrowed_.push_back(false);
+    return term_id;
+}
+
+void TermDictionary::ReuseErasedIds() {
+    erased_ids_.clear();
+    for (TermId term_id = static_cast<TermId>(terms_.size()); term_id-- > 0; ) {
+        if (terms_[term_id].empty()) {
+            erased_ids_.push_back(term_id);
+        }
+    }
+}
+
+string_view TermDictionary::GetTerm(TermId term_id) const {
+    return terms_[term_id];
+}
+
+size_t TermDictionary::size() const {
+    return terms_.size();
+}
+
+size_t TermDictionary::GetAllocatedBytes() const {
+    return arena_.GetAllocatedBytes();
+}
+
+size_t TermDictionary::FindSlot(string_view term, size_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+        const TermId term_id = slots_[slot];
+        if (term_id == NO_TERM || (term_hashes_[term_id] == hash && terms_[term_id] == term)) {
+            return slot;
+        }
+    }
+}
+
+TermId TermDictionary::Insert(string_view term, bool copy) {
+    if ((terms_.size() + 1) * 2 > slots_.size()) {
+        Rehash(max<size_t>(16, slots_.size() * 2));
+    }
+
+    const size_t term_hash = hash<string_view>{}(term);
+    const size_t slot = FindSlot(term, term_hash);
+    if (slots_[slot] != NO_TERM) {
+        return slots_[slot];
+    }
+
+    const string_view stored_term = copy ? StoreTerm(term) : term;
+    TermId term_id;
+    if (erased_ids_.empty()) {
+        term_id = static_cast<TermId>(terms_.size());
+        terms_.push_back(stored_term);
+        term_hashes_.push_back(term_hash);
+        is_borrowed_.push_back(!copy);
+    }
+    else {
+        term_id = erased_ids_.back();
+        erased_ids_.pop_back();
+        terms_[term_id] = stored_term;
+        term_hashes_[term_id] = term_hash;
+        is_borrowed_[term_id] = !copy;
+    }
+    slots_[slot] = term_id;
+    return term_id;
+}
+
+void TermDictionary::Rehash(size_t slot_count) {
+    slots_.assign(slot_count, NO_TERM);
+    const size_t mask = slot_count - 1;
+    for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+        if (terms_[term_id].empty()) {
+            continue;
+        }
+        size_t slot = term_hashes_[term_id] & mask;
+        while (slots_[slot] != NO_TERM) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = term_id;
+    }
+}
+
+string_view TermDictionary::StoreTerm(string_view term) {
+    const auto span_it = free_spans_.lower_bound(term.size());
+    if (span_it == free_spans_.end()) {
+        return arena_.Copy(term);
+    }
+    const size_t span_size = span_it->first;
+    char* const span = span_it->second.back();
+    span_it->second.pop_back();
+    if (span_it->second.empty()) {
+        free_spans_.erase(span_it);
+    }
+    memcpy(span, term.data(), term.size());
+    if (span_size > term.size()) {
+        free_spans_[span_size - term.size()].push_back(span + term.size());
+    }
+    return { span, term.size() };
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "string_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string_view>
+#include <vector>
+
+using TermId = uint32_t;
+
+const TermId NO_TERM = std::numeric_limits<TermId>::max();
+
+// Interns every distinct word once and numbers the words densely in order of
+// first appearance, reusing the ids of erased terms first. Term text is
+// copied into a StringArena, so the views handed out stay valid until the
+// term is erased no matter what happens to the text the word came from. The
+// space of erased terms' text goes to new terms, so churn doesn't grow the
+// arena. Lookup goes through an open-addressing table with linear probing
+// kept at most half full.
+class TermDictionary {
+public:
+    TermDictionary();
+    TermDictionary(const TermDictionary& other);
+    TermDictionary& operator=(const TermDictionary& other);
+    TermDictionary(TermDictionary&& other) = default;
+    TermDictionary& operator=(TermDictionary&& other) = default;
+
+    // Returns NO_TERM for a word that was never interned.
+    TermId Find(std::string_view term) const;
+
+    // Returns the id of term, assigning the next free one if it is new.
+    TermId Intern(std::string_view term);
+
+    // Like Intern, but keeps a view of term instead of a copy, so the text
+    // must outlive the dictionary. Meant for terms in a mapped snapshot.
+    TermId InternBorrowed(std::string_view term);
+
+    // Forgets the term: Find no longer returns its id, and the id and the
+    // space of its text go to the next new terms. Views of its text handed
+    // out before are invalidated; those of other terms stay valid.
+    void Erase(TermId term_id);
+
+    // Appends an id that belongs to no term, the way Erase leaves one, so a
+    // dictionary can be rebuilt id for id. Intern doesn't hand these ids out
+    // until ReuseErasedIds is called.
+    TermId AddErased();
+    void ReuseErasedIds();
+
+    // Empty for an erased id
+    std::string_view GetTerm(TermId term_id) const;
+
+    // Bound of the ids handed out so far, erased ones included
+    size_t size() const;
+
+    // Memory the arena took for term text, reused space included once
+    size_t GetAllocatedBytes() const;
+
+private:
+    static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+    // Index of the slot that holds term or of the empty slot where it belongs.
+    size_t FindSlot(std::string_view term, size_t hash) const;
+    TermId Insert(std::string_view term, bool copy);
+    void Rehash(size_t slot_count);
+    // Copies term into the smallest free span that holds it, or into the
+    // arena if there is none
+    std::string_view StoreTerm(std::string_view term);
+
+    StringArena arena_;
+    // Arena space of erased terms by size. A span is split when a shorter
+    // term takes it, the rest going back here.
+    std::map<size_t, std::vector<char*>> free_spans_;
+
+    std::vector<std::string_view> terms_;  // indexed by term id, empty if erased
+    std::vector<size_t> term_hashes_;      // indexed by term id
+    std::vector<bool> is_borrowed_;        // indexed by term id, true for InternBorrowed text
+    std::vector<TermId> slots_;            // NO_TERM marks an empty slot, size is a power of two
+    std::vector<TermId> erased_ids_;       // reused last in first out
+};
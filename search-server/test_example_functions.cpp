@@ -47,15 +47,11 @@ void FindTopDocuments(const SearchServer& search_server, const string& raw_query
 void MatchDocuments(const SearchServer& search_server, const string& query) {
     try {
         cout << "Matching document for query: "s << query << endl;
-        // const int document_count = search_server.GetDocumentCount();
-        // for (int index = 0; index < document_count; ++index) {
-        //     const int document_id = search_server.GetDocumentId(index);
-        //     const auto [words, status] = search_server.MatchDocument(query, document_id);
-        //     PrintMatchDocumentResult(document_id, words, status);
-        // }
-        for (const int document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+        const vector<int> document_ids(search_server.begin(), search_server.end());
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
         }
     }
     catch (const exception& e) {
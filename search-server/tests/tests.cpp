@@ -0,0 +1,857 @@
+// Checks of the parts of the server that keep state across calls: the
+// segments of ConcurrentSearchServer, the result cache, snapshots, swept
+// removals, the term dictionary, the RequestQueue window, streamed queries
+// and the limits of asynchronous ones, plus batched matching, duplicate
+// detection and the vectorized tokenizer. Most of them compare a server
+// that got there the long way with one built straight from the documents it
+// should hold. Prints the failed check and exits with status 1 on the first
+// failure:
+//
+//     tests
+#include "../concurrent_search_server.h"
+#include "../generators.h"
+#include "../process_queries.h"
+#include "../query_result_cache.h"
+#include "../remove_duplicates.h"
+#include "../request_queue.h"
+#include "../search_server.h"
+#include "../string_processing.h"
+#include "../term_dictionary.h"
+#include "../thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <execution>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+void AssertImpl(bool value, const char* expression, const char* file, int line, const string& hint) {
+    if (!value) {
+        cerr << file << "(" << line << "): ASSERT(" << expression << ") failed";
+        if (!hint.empty()) {
+            cerr << ", " << hint;
+        }
+        cerr << endl;
+        exit(1);
+    }
+}
+
+#define ASSERT(expression) AssertImpl(!!(expression), #expression, __FILE__, __LINE__, ""s)
+#define ASSERT_HINT(expression, hint) AssertImpl(!!(expression), #expression, __FILE__, __LINE__, (hint))
+
+#define RUN_TEST(function) \
+    do { \
+        function(); \
+        cerr << #function << " OK" << endl; \
+    } while (false)
+
+const string STOP_WORDS = "and in on"s;
+
+struct TestCorpus {
+    vector<string> dictionary;
+    vector<string> queries;
+    mt19937 generator;
+
+    explicit TestCorpus(unsigned seed, int word_count = 300)
+        : generator(seed)
+    {
+        dictionary = GenerateDictionary(generator, word_count, 6);
+        dictionary.push_back("and"s);
+        for (int i = 0; i < 40; ++i) {
+            queries.push_back(GenerateQuery(generator, dictionary, uniform_int_distribution(1, 4)(generator), 0.2));
+        }
+    }
+
+    string MakeText() {
+        return GenerateQuery(generator, dictionary, uniform_int_distribution(1, 20)(generator));
+    }
+
+    DocumentStatus MakeStatus() {
+        return uniform_int_distribution(0, 3)(generator) == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+    }
+
+    vector<int> MakeRatings() {
+        return { uniform_int_distribution(-10, 10)(generator), uniform_int_distribution(-10, 10)(generator) };
+    }
+};
+
+void AssertSameDocuments(const vector<Document>& lhs, const vector<Document>& rhs, const string& query) {
+    ASSERT_HINT(lhs.size() == rhs.size(), "query: "s + query);
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        ASSERT_HINT(lhs[i].id == rhs[i].id, "query: "s + query);
+        ASSERT_HINT(lhs[i].rating == rhs[i].rating, "query: "s + query);
+        ASSERT_HINT(abs(lhs[i].relevance - rhs[i].relevance) < 1e-9, "query: "s + query);
+    }
+}
+
+template <typename Server>
+void AssertSameResults(const SearchServer& expected, const Server& server, const vector<string>& queries) {
+    ASSERT(server.GetDocumentCount() == expected.GetDocumentCount());
+    for (const string& query : queries) {
+        AssertSameDocuments(server.FindTopDocuments(query), expected.FindTopDocuments(query), query);
+        AssertSameDocuments(server.FindTopDocuments(query, DocumentStatus::BANNED, 20),
+            expected.FindTopDocuments(query, DocumentStatus::BANNED, 20), query);
+        AssertSameDocuments(server.FindTopDocuments(execution::par, query),
+            expected.FindTopDocuments(execution::par, query), query);
+    }
+}
+
+void AssertSameMatches(const SearchServer& expected, const ConcurrentSearchServer& server, const string& query) {
+    for (const int document_id : expected) {
+        const auto [expected_words, expected_status] = expected.MatchDocument(query, document_id);
+        const auto [words, status] = server.MatchDocument(query, document_id);
+        ASSERT_HINT(status == expected_status, "query: "s + query);
+        ASSERT_HINT(vector<string>(words.begin(), words.end())
+            == vector<string>(expected_words.begin(), expected_words.end()), "query: "s + query);
+    }
+}
+
+// A SearchServer fed the same adds and removes is the reference
+void TestConcurrentServerMatchesSearchServer(PostingsFormat postings_format) {
+    TestCorpus corpus(17);
+    MergePolicy merge_policy;
+    merge_policy.memtable_capacity = 8;
+    merge_policy.merge_factor = 2;
+    merge_policy.postings_format = postings_format;
+    merge_policy.background_merges = false;
+    ConcurrentSearchServer server(STOP_WORDS, merge_policy);
+    SearchServer expected(STOP_WORDS);
+
+    vector<int> live_ids;
+    bool has_merged = false;
+    for (int document_id = 0; document_id < 600; ++document_id) {
+        const string text = corpus.MakeText();
+        const DocumentStatus status = corpus.MakeStatus();
+        const vector<int> ratings = corpus.MakeRatings();
+        server.AddDocument(document_id, text, status, ratings);
+        expected.AddDocument(document_id, text, status, ratings);
+        live_ids.push_back(document_id);
+
+        if (document_id % 3 == 2) {
+            const size_t index = uniform_int_distribution<size_t>(0, live_ids.size() - 1)(corpus.generator);
+            server.RemoveDocument(live_ids[index]);
+            expected.RemoveDocument(live_ids[index]);
+            live_ids.erase(live_ids.begin() + index);
+        }
+        if (document_id % 50 == 49) {
+            const size_t segment_count = server.GetSnapshot().GetSegmentCount();
+            server.RunPendingMerges();
+            has_merged = has_merged || server.GetSnapshot().GetSegmentCount() < segment_count;
+            AssertSameResults(expected, server, corpus.queries);
+        }
+    }
+    ASSERT(has_merged);
+    AssertSameResults(expected, server, corpus.queries);
+    for (size_t i = 0; i < 5; ++i) {
+        AssertSameMatches(expected, server, corpus.queries[i]);
+    }
+}
+
+void TestConcurrentServerMatchesSearchServer() {
+    TestConcurrentServerMatchesSearchServer(PostingsFormat::PLAIN);
+    TestConcurrentServerMatchesSearchServer(PostingsFormat::COMPRESSED);
+}
+
+// Enough deletes, one by one and batched, to fold tombstones several times
+// over before a rewrite drops them; batches mix in the memtable, repeated
+// and unknown ids
+void TestConcurrentServerRemovals() {
+    TestCorpus corpus(59);
+    MergePolicy merge_policy;
+    merge_policy.memtable_capacity = 2000;
+    merge_policy.max_deleted_ratio = 0.5;
+    merge_policy.background_merges = false;
+    ConcurrentSearchServer server(STOP_WORDS, merge_policy);
+    SearchServer expected(STOP_WORDS);
+    for (int document_id = 0; document_id < 2100; ++document_id) {
+        const string text = corpus.MakeText();
+        const DocumentStatus status = corpus.MakeStatus();
+        const vector<int> ratings = corpus.MakeRatings();
+        server.AddDocument(document_id, text, status, ratings);
+        expected.AddDocument(document_id, text, status, ratings);
+    }
+    ASSERT(server.GetSnapshot().GetSegmentCount() == 1);
+
+    for (int document_id = 0; document_id < 600; document_id += 2) {
+        server.RemoveDocument(document_id);
+        expected.RemoveDocument(document_id);
+        if (document_id % 100 == 0) {
+            AssertSameResults(expected, server, corpus.queries);
+        }
+    }
+    vector<int> removed_ids = { 2050, 2050, 5000, 601, 601 };
+    for (int document_id = 603; document_id < 900; document_id += 2) {
+        removed_ids.push_back(document_id);
+    }
+    server.RemoveDocuments(removed_ids);
+    expected.RemoveDocuments(removed_ids);
+    AssertSameResults(expected, server, corpus.queries);
+
+    vector<int> more_removed_ids;
+    for (int document_id = 900; document_id < 1500; ++document_id) {
+        more_removed_ids.push_back(document_id);
+    }
+    server.RemoveDocuments(more_removed_ids);
+    expected.RemoveDocuments(more_removed_ids);
+    AssertSameResults(expected, server, corpus.queries);
+    server.RunPendingMerges();
+    AssertSameResults(expected, server, corpus.queries);
+    for (size_t i = 0; i < 5; ++i) {
+        AssertSameMatches(expected, server, corpus.queries[i]);
+    }
+}
+
+// Every change to the set of documents makes the cached results stale, and
+// the status and result count are part of the key. The reference server has
+// no cache.
+void TestResultCacheInvalidation() {
+    TestCorpus corpus(61);
+    SearchServer server(STOP_WORDS);
+    SearchServer expected(STOP_WORDS);
+    server.SetResultCacheCapacity(256);
+    const auto add_document = [&](int document_id) {
+        const string text = corpus.MakeText();
+        const DocumentStatus status = corpus.MakeStatus();
+        const vector<int> ratings = corpus.MakeRatings();
+        server.AddDocument(document_id, text, status, ratings);
+        expected.AddDocument(document_id, text, status, ratings);
+    };
+    // Runs the queries twice, the second time from the cache
+    const auto check = [&]() {
+        const uint64_t hits = server.GetResultCacheStats().hits;
+        AssertSameResults(expected, server, corpus.queries);
+        AssertSameResults(expected, server, corpus.queries);
+        ASSERT(server.GetResultCacheStats().hits >= hits + 3 * corpus.queries.size());
+    };
+
+    for (int document_id = 0; document_id < 300; ++document_id) {
+        add_document(document_id);
+    }
+    check();
+    add_document(300);
+    check();
+
+    vector<NewDocument> batch;
+    vector<string> texts;
+    texts.reserve(50);
+    for (int document_id = 301; document_id < 351; ++document_id) {
+        texts.push_back(corpus.MakeText());
+        batch.push_back({ document_id, texts.back(), DocumentStatus::ACTUAL, { 3 } });
+    }
+    server.AddDocuments(batch);
+    expected.AddDocuments(batch);
+    check();
+
+    server.RemoveDocument(7);
+    expected.RemoveDocument(7);
+    check();
+    // Few enough to stay tombstoned, so the sweep below has work to do
+    const vector<int> removed_ids = { 1, 2, 3, 5, 8, 13, 21, 34, 55 };
+    server.RemoveDocuments(removed_ids);
+    expected.RemoveDocuments(removed_ids);
+    check();
+    server.CompactPostings();
+    check();
+
+    // Same query, other status or count: other entries
+    for (const string& query : corpus.queries) {
+        for (const size_t max_result_count : { size_t{ 1 }, size_t{ 3 }, size_t{ 20 } }) {
+            for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                AssertSameDocuments(server.FindTopDocuments(query, status, max_result_count),
+                    expected.FindTopDocuments(query, status, max_result_count), query);
+            }
+        }
+    }
+}
+
+// Entries are evicted least recently used first within a shard; the keys
+// are picked to share one, the way the cache spreads them
+void TestResultCacheEviction() {
+    const size_t shard_count = 16;
+    QueryResultCache cache(2 * shard_count);
+    vector<string> keys;
+    for (int i = 0; keys.size() < 3; ++i) {
+        const string key = "query"s + to_string(i);
+        if (hash<string_view>{}(key) % shard_count == 0) {
+            keys.push_back(key);
+        }
+    }
+    const vector<Document> documents = { { 1, 0.5, 1 } };
+    cache.Insert(keys[0], 1, documents);
+    cache.Insert(keys[1], 1, documents);
+    ASSERT(cache.Find(keys[0], 1).has_value());
+    cache.Insert(keys[2], 1, documents);
+    ASSERT(cache.GetStats().evictions == 1);
+    ASSERT(cache.Find(keys[0], 1).has_value());
+    ASSERT(cache.Find(keys[2], 1).has_value());
+    ASSERT(!cache.Find(keys[1], 1).has_value());
+
+    // An entry of another generation is a miss and goes away
+    ASSERT(!cache.Find(keys[0], 2).has_value());
+    ASSERT(!cache.Find(keys[0], 1).has_value());
+    ASSERT(cache.GetStats().size == 1);
+}
+
+// A loaded snapshot keeps the documents removed before the save removed, and
+// the borrowed postings take changes like owned ones
+void TestCompressedSnapshotRoundTrip() {
+    TestCorpus corpus(29);
+    SearchServer saved(STOP_WORDS);
+    SearchServer expected(STOP_WORDS);
+    saved.SetPostingsFormat(PostingsFormat::COMPRESSED);
+    for (int document_id = 0; document_id < 500; ++document_id) {
+        const string text = corpus.MakeText();
+        const DocumentStatus status = corpus.MakeStatus();
+        const vector<int> ratings = corpus.MakeRatings();
+        saved.AddDocument(document_id, text, status, ratings);
+        expected.AddDocument(document_id, text, status, ratings);
+    }
+    // Few enough to stay tombstoned rather than swept
+    for (int document_id = 0; document_id < 500; document_id += 7) {
+        saved.RemoveDocument(document_id);
+        expected.RemoveDocument(document_id);
+    }
+
+    const string path = "search_server_tests.snapshot"s;
+    saved.SaveSnapshot(path);
+    SearchServer loaded(""s);
+    loaded.LoadSnapshot(path);
+    ASSERT(loaded.GetPostingsFormat() == PostingsFormat::COMPRESSED);
+    AssertSameResults(expected, loaded, corpus.queries);
+    for (const int document_id : expected) {
+        ASSERT(loaded.GetDocumentText(document_id) == saved.GetDocumentText(document_id));
+        ASSERT(loaded.GetWordFrequencies(document_id) == expected.GetWordFrequencies(document_id));
+    }
+
+    for (int document_id = 500; document_id < 600; ++document_id) {
+        const string text = corpus.MakeText();
+        loaded.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 1 });
+        expected.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 1 });
+    }
+    for (int document_id = 1; document_id < 600; document_id += 3) {
+        loaded.RemoveDocument(document_id);
+        expected.RemoveDocument(document_id);
+    }
+    AssertSameResults(expected, loaded, corpus.queries);
+    remove(path.c_str());
+}
+
+// After the sweep the server ranks exactly as one that never held the
+// removed documents
+void TestRemoveDocumentsAndSweep() {
+    for (const PostingsFormat postings_format : { PostingsFormat::PLAIN, PostingsFormat::COMPRESSED }) {
+        TestCorpus corpus(43);
+        SearchServer server(STOP_WORDS);
+        server.SetPostingsFormat(postings_format);
+        vector<string> texts;
+        vector<DocumentStatus> statuses;
+        vector<vector<int>> ratings;
+        for (int document_id = 0; document_id < 1000; ++document_id) {
+            texts.push_back(corpus.MakeText());
+            statuses.push_back(corpus.MakeStatus());
+            ratings.push_back(corpus.MakeRatings());
+            server.AddDocument(document_id, texts.back(), statuses.back(), ratings.back());
+        }
+
+        vector<int> removed_ids;
+        for (int document_id = 0; document_id < 1000; document_id += 2) {
+            removed_ids.push_back(document_id);
+        }
+        removed_ids.push_back(5000);  // unknown, skipped
+        server.RemoveDocuments(execution::par, removed_ids);
+        server.RemoveDocuments(vector<int>{ 1, 3, 5 });
+        server.CompactPostings();
+
+        SearchServer expected(STOP_WORDS);
+        for (const int document_id : server) {
+            expected.AddDocument(document_id, texts[document_id], statuses[document_id], ratings[document_id]);
+        }
+        ASSERT(server.GetDocumentCount() == 497);
+        for (const ScoringMode scoring_mode : { ScoringMode::MAX_SCORE, ScoringMode::EXHAUSTIVE }) {
+            server.SetScoringMode(scoring_mode);
+            AssertSameResults(expected, server, corpus.queries);
+        }
+
+        for (int document_id = 1000; document_id < 1100; ++document_id) {
+            const string text = corpus.MakeText();
+            server.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 2 });
+            expected.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 2 });
+        }
+        AssertSameResults(expected, server, corpus.queries);
+    }
+}
+
+// Snapshots hold a record per ordinal, so their size tells how far the
+// ordinal space has grown
+size_t GetSnapshotSize(const SearchServer& server) {
+    const string path = "search_server_tests.snapshot"s;
+    server.SaveSnapshot(path);
+    ifstream snapshot(path, ios::binary | ios::ate);
+    const size_t size = static_cast<size_t>(snapshot.tellg());
+    snapshot.close();
+    remove(path.c_str());
+    return size;
+}
+
+// A rolling window of documents keeps the ordinal space as large as the
+// window, with texts and matches following the renumbered documents
+void TestChurnKeepsOrdinalsDense() {
+    for (const PostingsFormat postings_format : { PostingsFormat::PLAIN, PostingsFormat::COMPRESSED }) {
+        TestCorpus corpus(47);
+        SearchServer server(STOP_WORDS);
+        server.SetPostingsFormat(postings_format);
+        map<int, string> texts;
+        int next_id = 0;
+        for (int round = 0; round < 30; ++round) {
+            for (int i = 0; i < 100; ++i) {
+                texts[next_id] = corpus.MakeText();
+                server.AddDocument(next_id, texts[next_id], DocumentStatus::ACTUAL, { round });
+                ++next_id;
+            }
+            if (texts.size() > 300) {
+                vector<int> removed_ids;
+                while (texts.size() > 200) {
+                    removed_ids.push_back(texts.begin()->first);
+                    texts.erase(texts.begin());
+                }
+                server.RemoveDocuments(removed_ids);
+            }
+        }
+        server.CompactPostings();
+
+        SearchServer expected(STOP_WORDS);
+        for (const auto& [document_id, text] : texts) {
+            expected.AddDocument(document_id, text, DocumentStatus::ACTUAL, { document_id / 100 });
+        }
+        AssertSameResults(expected, server, corpus.queries);
+        for (const auto& [document_id, text] : texts) {
+            ASSERT(server.GetDocumentText(document_id) == text);
+            for (const string& query : { corpus.queries[0], corpus.queries[1] }) {
+                ASSERT(get<0>(server.MatchDocument(query, document_id))
+                    == get<0>(expected.MatchDocument(query, document_id)));
+            }
+        }
+        ASSERT(GetSnapshotSize(server) < GetSnapshotSize(expected) * 5 / 4);
+    }
+}
+
+// Churn of distinct words reuses the space of erased terms instead of
+// growing the arena, and leaves the terms that stay untouched
+void TestTermDictionaryReusesErasedSpace() {
+    mt19937 generator(3);
+    TermDictionary dictionary;
+    map<TermId, string> kept_terms;
+    for (int i = 0; i < 100; ++i) {
+        const string term = "kept"s + to_string(i);
+        kept_terms[dictionary.Intern(term)] = term;
+    }
+
+    size_t first_round_bytes = 0;
+    int next_word = 0;
+    for (int round = 0; round < 50; ++round) {
+        vector<TermId> term_ids;
+        for (int i = 0; i < 20000; ++i) {
+            const string term = GenerateWord(generator, 8) + to_string(next_word++);
+            const TermId term_id = dictionary.Intern(term);
+            ASSERT(dictionary.GetTerm(term_id) == term);
+            term_ids.push_back(term_id);
+        }
+        if (round == 0) {
+            first_round_bytes = dictionary.GetAllocatedBytes();
+        }
+        for (const TermId term_id : term_ids) {
+            dictionary.Erase(term_id);
+        }
+    }
+    ASSERT(dictionary.GetAllocatedBytes() <= 2 * first_round_bytes);
+    for (const auto& [term_id, term] : kept_terms) {
+        ASSERT(dictionary.GetTerm(term_id) == term);
+        ASSERT(dictionary.Find(term) == term_id);
+    }
+}
+
+void TestRequestQueueWindow() {
+    SearchServer server(STOP_WORDS);
+    server.AddDocument(1, "curly cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "curly dog"s, DocumentStatus::ACTUAL, { 2 });
+
+    RequestQueue queue(server, chrono::milliseconds(100));
+    queue.AddFindRequest("curly"s);
+    queue.AddFindRequest("cat"s);
+    queue.AddFindRequest("parrot"s);
+    RequestQueue::Stats stats = queue.GetStats();
+    ASSERT(stats.request_count == 3);
+    ASSERT(stats.no_result_count == 1);
+    ASSERT(queue.GetNoResultRequests() == 1);
+    ASSERT(stats.result_size_counts.size() == 3);
+    ASSERT(stats.result_size_counts[0] == 1 && stats.result_size_counts[1] == 1 && stats.result_size_counts[2] == 1);
+
+    this_thread::sleep_for(chrono::milliseconds(150));
+    stats = queue.GetStats();
+    ASSERT(stats.request_count == 0);
+    ASSERT(queue.GetNoResultRequests() == 0);
+    ASSERT(stats.total_request_count == 3);
+    ASSERT(stats.total_no_result_count == 1);
+
+    queue.AddFindRequest("hamster"s);
+    stats = queue.GetStats();
+    ASSERT(stats.request_count == 1);
+    ASSERT(stats.no_result_count == 1);
+    ASSERT(stats.total_request_count == 4);
+
+    // A ring smaller than the window's requests keeps the latest of them
+    RequestQueue small_queue(server, chrono::hours(1), 4);
+    for (int i = 0; i < 10; ++i) {
+        small_queue.AddFindRequest(i < 6 ? "parrot"s : "cat"s);
+    }
+    stats = small_queue.GetStats();
+    ASSERT(stats.request_count == 4);
+    ASSERT(stats.no_result_count == 0);
+    ASSERT(stats.total_request_count == 10);
+    ASSERT(stats.total_no_result_count == 6);
+}
+
+// The caller of ProcessQueriesJoined runs the query it waits for itself
+// rather than whatever the pool has queued, so slow unrelated tasks on a
+// busy pool don't hold the stream up
+void TestStreamedQueriesSkipUnrelatedTasks() {
+    TestCorpus corpus(53);
+    SearchServer server(STOP_WORDS);
+    for (int document_id = 0; document_id < 300; ++document_id) {
+        server.AddDocument(document_id, corpus.MakeText(), corpus.MakeStatus(), corpus.MakeRatings());
+    }
+    vector<Document> expected;
+    for (const string& query : corpus.queries) {
+        for (const Document& document : server.FindTopDocuments(query)) {
+            expected.push_back(document);
+        }
+    }
+
+    ThreadPool::SetDefaultThreadCount(1);
+    const shared_ptr<ThreadPool> pool = ThreadPool::GetDefault();
+    for (int i = 0; i < 2; ++i) {
+        pool->Submit([] { this_thread::sleep_for(chrono::milliseconds(300)); });
+    }
+    const auto start_time = chrono::steady_clock::now();
+    chrono::steady_clock::duration first_result_time{};
+    vector<Document> documents;
+    ProcessQueriesJoined(server, corpus.queries,
+        [&](Document&& document) {
+            if (documents.empty()) {
+                first_result_time = chrono::steady_clock::now() - start_time;
+            }
+            documents.push_back(move(document));
+        }
+    );
+    ThreadPool::SetDefaultThreadCount(0);
+
+    ASSERT(first_result_time < chrono::milliseconds(200));
+    AssertSameDocuments(documents, expected, "joined"s);
+}
+
+// Limits reached before the scan leave nothing, reached during it leave
+// what was scored so far; either way the result says it is partial
+void TestAsyncQueryLimits() {
+    TestCorpus corpus(59);
+    SearchServer server(STOP_WORDS);
+    for (int document_id = 0; document_id < 20000; ++document_id) {
+        server.AddDocument(document_id, "curly "s + corpus.MakeText(), DocumentStatus::ACTUAL, corpus.MakeRatings());
+    }
+    const string query = "curly "s + corpus.queries[0];
+
+    for (const ScoringMode scoring_mode : { ScoringMode::MAX_SCORE, ScoringMode::EXHAUSTIVE }) {
+        server.SetScoringMode(scoring_mode);
+        TopDocumentsResult result = server.FindTopDocumentsAsync(query).get();
+        ASSERT(!result.is_partial);
+        AssertSameDocuments(result.documents, server.FindTopDocuments(query), query);
+
+        QueryLimits expired;
+        expired.deadline = chrono::steady_clock::now() - chrono::seconds(1);
+        result = server.FindTopDocumentsAsync(query, expired).get();
+        ASSERT(result.is_partial);
+        ASSERT(result.documents.empty());
+
+        QueryLimits cancelled;
+        cancelled.cancellation.Cancel();
+        result = server.FindTopDocumentsAsync(query, DocumentStatus::ACTUAL, cancelled).get();
+        ASSERT(result.is_partial);
+        ASSERT(result.documents.empty());
+
+        // The predicate cancels the query at the first document it sees
+        QueryLimits limits;
+        int predicate_call_count = 0;
+        result = server.FindTopDocumentsAsync(query,
+            [&predicate_call_count, cancellation = limits.cancellation](int, DocumentStatus, int) {
+                cancellation.Cancel();
+                ++predicate_call_count;
+                return true;
+            },
+            limits).get();
+        ASSERT(limits.cancellation.IsCancelled());
+        ASSERT(result.is_partial);
+        ASSERT(predicate_call_count < server.GetDocumentCount());
+        ASSERT(result.documents.size() <= MAX_RESULT_DOCUMENT_COUNT);
+    }
+
+    QueryLimits cancelled;
+    cancelled.cancellation.Cancel();
+    future<tuple<vector<string_view>, DocumentStatus>> match = server.MatchDocumentAsync(query, 0, cancelled);
+    bool is_interrupted = false;
+    try {
+        match.get();
+    }
+    catch (const QueryInterruptedError&) {
+        is_interrupted = true;
+    }
+    ASSERT(is_interrupted);
+
+    const auto [words, status] = server.MatchDocumentAsync(query, 0).get();
+    const auto [expected_words, expected_status] = server.MatchDocument(query, 0);
+    ASSERT(status == expected_status);
+    ASSERT(vector<string>(words.begin(), words.end()) == vector<string>(expected_words.begin(), expected_words.end()));
+
+    // Errors of the query itself come out of get(), not of the call
+    for (const string& invalid_query : { "curly --cat"s, "curly -"s, "cur\x01ly"s }) {
+        future<TopDocumentsResult> top_documents = server.FindTopDocumentsAsync(invalid_query);
+        bool is_invalid = false;
+        try {
+            top_documents.get();
+        }
+        catch (const invalid_argument&) {
+            is_invalid = true;
+        }
+        ASSERT_HINT(is_invalid, "query: "s + invalid_query);
+    }
+    bool is_unknown = false;
+    try {
+        server.MatchDocumentAsync(query, 20000).get();
+    }
+    catch (const invalid_argument&) {
+        is_unknown = true;
+    }
+    ASSERT(is_unknown);
+}
+
+// Byte at a time, as the tokenizer was before it was vectorized
+vector<string_view> SplitIntoWordsReference(string_view text) {
+    vector<string_view> words;
+    size_t word_begin = 0;
+    for (size_t pos = 0; pos <= text.size(); ++pos) {
+        if (pos == text.size() || text[pos] == ' ') {
+            if (pos > word_begin) {
+                words.push_back(text.substr(word_begin, pos - word_begin));
+            }
+            word_begin = pos + 1;
+        }
+    }
+    return words;
+}
+
+bool HasControlCharacters(string_view text) {
+    for (const char c : text) {
+        if (static_cast<unsigned char>(c) < ' ') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Views must point to the same bytes, not only hold the same characters
+void AssertSameSplit(const string& text) {
+    const string hint = "text of "s + to_string(text.size()) + " bytes"s;
+    const vector<string_view> expected = SplitIntoWordsReference(text);
+    const vector<string_view> words = SplitIntoWordsView(text);
+    ASSERT_HINT(words.size() == expected.size(), hint);
+    for (size_t i = 0; i < words.size(); ++i) {
+        ASSERT_HINT(words[i].data() == expected[i].data() && words[i].size() == expected[i].size(), hint);
+    }
+
+    // Appends after what words already holds
+    vector<string_view> valid_words{ "kept"sv };
+    const bool is_valid = SplitIntoValidWordsView(text, valid_words);
+    ASSERT_HINT(is_valid == !HasControlCharacters(text), hint);
+    ASSERT_HINT(valid_words.front() == "kept"sv, hint);
+    if (is_valid) {
+        ASSERT_HINT(valid_words.size() == expected.size() + 1, hint);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_HINT(valid_words[i + 1].data() == expected[i].data()
+                && valid_words[i + 1].size() == expected[i].size(), hint);
+        }
+    }
+}
+
+// The vectorized split takes 16 or 32 bytes per step and the tail one at a
+// time, so lengths around multiples of 32 and spaces, control bytes and
+// bytes >= 0x80 on either side of a step boundary are where it can go wrong
+void TestSplitMatchesReference() {
+    for (size_t size = 0; size <= 100; ++size) {
+        AssertSameSplit(string(size, 'a'));
+        AssertSameSplit(string(size, ' '));
+        for (size_t pos = 0; pos < size; ++pos) {
+            string text(size, 'a');
+            text[pos] = ' ';
+            AssertSameSplit(text);
+            text[pos] = '\x1F';
+            AssertSameSplit(text);
+            text[pos] = '\x80';
+            AssertSameSplit(text);
+            text[pos] = '\xFF';
+            AssertSameSplit(text);
+        }
+    }
+    // Runs of spaces and words across one and several step boundaries
+    for (size_t begin = 0; begin < 70; ++begin) {
+        for (const size_t length : { 1, 2, 15, 16, 17, 31, 32, 33, 48 }) {
+            string text(begin + length + 5, 'w');
+            fill(text.begin() + begin, text.begin() + begin + length, ' ');
+            AssertSameSplit(text);
+            string spaces(begin + length + 5, ' ');
+            fill(spaces.begin() + begin, spaces.begin() + begin + length, '\xD0');
+            AssertSameSplit(spaces);
+        }
+    }
+
+    mt19937 generator(61);
+    const string alphabet = "ab \xD0\xB9\x7F\x80\xFF\x01\x1F\t"s;
+    discrete_distribution<size_t> byte_index({ 30, 20, 30, 5, 5, 2, 2, 2, 1, 1, 1 });
+    uniform_int_distribution<size_t> size_distribution(0, 130);
+    for (int i = 0; i < 200000; ++i) {
+        string text(size_distribution(generator), ' ');
+        for (char& c : text) {
+            c = alphabet[byte_index(generator)];
+        }
+        AssertSameSplit(text);
+    }
+}
+
+// A batch answers as MatchDocument does for each id, in the order given
+void TestMatchDocumentsMatchesMatchDocument() {
+    TestCorpus corpus(67);
+    SearchServer server(STOP_WORDS);
+    for (int document_id = 0; document_id < 400; ++document_id) {
+        server.AddDocument(document_id, corpus.MakeText(), corpus.MakeStatus(), corpus.MakeRatings());
+    }
+    for (int document_id = 0; document_id < 400; document_id += 5) {
+        server.RemoveDocument(document_id);
+    }
+    vector<int> document_ids(server.begin(), server.end());
+    shuffle(document_ids.begin(), document_ids.end(), corpus.generator);
+    document_ids.push_back(document_ids.front());
+
+    vector<string> queries = corpus.queries;
+    // A word that is both a plus- and a minus-word, and a minus-word no document has
+    queries.push_back(corpus.dictionary[0] + " "s + corpus.dictionary[1] + " -"s + corpus.dictionary[2]);
+    queries.push_back(corpus.dictionary[3] + " -"s + corpus.dictionary[3]);
+    queries.push_back(corpus.dictionary[4] + " -unknown"s);
+    for (const string& query : queries) {
+        const auto results = server.MatchDocuments(query, document_ids);
+        const auto par_results = server.MatchDocuments(execution::par, query, document_ids);
+        ASSERT_HINT(results.size() == document_ids.size() && par_results.size() == document_ids.size(),
+            "query: "s + query);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto [expected_words, expected_status] = server.MatchDocument(query, document_ids[i]);
+            for (const auto& [words, status] : { results[i], par_results[i] }) {
+                ASSERT_HINT(status == expected_status, "query: "s + query);
+                ASSERT_HINT(words == expected_words, "query: "s + query);
+            }
+        }
+    }
+
+    // An unknown id fails the whole batch before the query is even parsed
+    for (const string& query : { corpus.queries[0], "--invalid"s }) {
+        for (const bool is_parallel : { false, true }) {
+            vector<int> unknown_ids = document_ids;
+            unknown_ids.push_back(0);  // removed
+            string message;
+            try {
+                if (is_parallel) {
+                    server.MatchDocuments(execution::par, query, unknown_ids);
+                }
+                else {
+                    server.MatchDocuments(query, unknown_ids);
+                }
+            }
+            catch (const invalid_argument& error) {
+                message = error.what();
+            }
+            ASSERT_HINT(message == "no document with such id"s, "query: "s + query);
+        }
+    }
+}
+
+// Of a group of duplicates the one with the smallest id stays, whatever
+// order they were added in
+void TestDuplicatesKeepSmallestId() {
+    TestCorpus corpus(71);
+    SearchServer server(STOP_WORDS);
+    // Unrelated documents around the groups, a word of their own each
+    for (int document_id = 100; document_id < 400; ++document_id) {
+        server.AddDocument(document_id, corpus.MakeText() + " u"s + to_string(document_id), DocumentStatus::ACTUAL,
+            { 1 });
+    }
+    server.AddDocument(50, "a b c"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(10, "c b a a in"s, DocumentStatus::BANNED, { 2 });
+    server.AddDocument(30, "b and c a"s, DocumentStatus::ACTUAL, { 3 });
+    server.AddDocument(60, "a b c d"s, DocumentStatus::ACTUAL, { 1 });
+
+    // Similar enough that the bands all but surely pair them up
+    string base;
+    for (int i = 0; i < 19; ++i) {
+        base += "w"s + to_string(i) + " "s;
+    }
+    server.AddDocument(70, base + "w19"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(40, base + "y"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(20, base + "x"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(80, base.substr(0, base.size() / 2) + "z1 z2 z3 z4 z5 z6 z7"s, DocumentStatus::ACTUAL, { 1 });
+
+    const vector<int> exact_ids = FindDuplicates(server);
+    ASSERT(FindDuplicates(execution::par, server) == exact_ids);
+    ASSERT((exact_ids == vector<int>{ 30, 50 }));
+
+    // The base group is 19/21 similar; 80 shares only half of its words
+    const vector<int> near_ids = FindNearDuplicates(server);
+    ASSERT(FindNearDuplicates(execution::par, server) == near_ids);
+    ASSERT((near_ids == vector<int>{ 30, 40, 50, 70 }));
+
+    ASSERT((RemoveNearDuplicates(execution::par, server) == near_ids));
+    for (const int document_id : { 10, 20, 60, 80 }) {
+        ASSERT(!server.GetWordFrequencies(document_id).empty());
+    }
+    ASSERT(server.GetDocumentCount() == 304);
+    ASSERT(FindNearDuplicates(server).empty());
+}
+
+int main() {
+    RUN_TEST(TestConcurrentServerMatchesSearchServer);
+    RUN_TEST(TestConcurrentServerRemovals);
+    RUN_TEST(TestResultCacheInvalidation);
+    RUN_TEST(TestResultCacheEviction);
+    RUN_TEST(TestCompressedSnapshotRoundTrip);
+    RUN_TEST(TestRemoveDocumentsAndSweep);
+    RUN_TEST(TestChurnKeepsOrdinalsDense);
+    RUN_TEST(TestTermDictionaryReusesErasedSpace);
+    RUN_TEST(TestRequestQueueWindow);
+    RUN_TEST(TestStreamedQueriesSkipUnrelatedTasks);
+    RUN_TEST(TestAsyncQueryLimits);
+    RUN_TEST(TestSplitMatchesReference);
+    RUN_TEST(TestMatchDocumentsMatchesMatchDocument);
+    RUN_TEST(TestDuplicatesKeepSmallestId);
+    cerr << "All tests passed" << endl;
+}
@@ -0,0 +1,121 @@
+#include "thread_pool.h"
+
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// The pool the calling thread works for and its index there
+struct WorkerIdentity {
+    const ThreadPool* pool = nullptr;
+    size_t index = 0;
+};
+
+thread_local WorkerIdentity this_worker;
+
+mutex default_pool_mutex;
+shared_ptr<ThreadPool> default_pool;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = max(1u, thread::hardware_concurrency());
+    }
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(make_unique<Worker>());
+    }
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this, i] { RunWorker(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(wake_mutex_);
+        is_stopping_ = true;
+    }
+    wake_.notify_all();
+    for (thread& worker_thread : threads_) {
+        worker_thread.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size();
+}
+
+shared_ptr<ThreadPool> ThreadPool::GetDefault() {
+    lock_guard lock(default_pool_mutex);
+    if (default_pool == nullptr) {
+        default_pool = make_shared<ThreadPool>();
+    }
+    return default_pool;
+}
+
+void ThreadPool::SetDefaultThreadCount(size_t thread_count) {
+    shared_ptr<ThreadPool> pool = make_shared<ThreadPool>(thread_count);
+    lock_guard lock(default_pool_mutex);
+    default_pool.swap(pool);
+}
+
+void ThreadPool::Submit(Task task) {
+    // A worker keeps what it spawns, where it is the hottest in its cache
+    const size_t index = this_worker.pool == this
+        ? this_worker.index
+        : next_worker_.fetch_add(1, memory_order_relaxed) % workers_.size();
+    {
+        lock_guard lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(move(task));
+    }
+    queued_.fetch_add(1, memory_order_release);
+    {
+        lock_guard lock(wake_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::RunPendingTask() {
+    const bool is_worker = this_worker.pool == this;
+    const size_t first_index = is_worker ? this_worker.index : 0;
+    for (size_t offset = 0; offset < workers_.size(); ++offset) {
+        const size_t index = (first_index + offset) % workers_.size();
+        Worker& worker = *workers_[index];
+        Task task;
+        {
+            lock_guard lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+            if (is_worker && offset == 0) {
+                task = move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else {
+                task = move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+        }
+        queued_.fetch_sub(1, memory_order_relaxed);
+        task();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::RunWorker(size_t index) {
+    this_worker = { this, index };
+    for (;;) {
+        if (RunPendingTask()) {
+            continue;
+        }
+        unique_lock lock(wake_mutex_);
+        wake_.wait(lock, [this] { return is_stopping_ || queued_.load(memory_order_acquire) > 0; });
+        if (is_stopping_ && queued_.load(memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
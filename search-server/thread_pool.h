@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing executor behind the parallel overloads of SearchServer and
+// ProcessQueries. Every worker has a deque of its own: it pushes and pops
+// tasks at the back and, once the deque is empty, steals from the front of
+// the others', so the oldest and usually biggest pieces of work migrate.
+// A thread calling ParallelFor works through the chunks of its own call
+// alongside the workers and sleeps only once they are all taken. It never
+// picks up unrelated tasks, so a short call doesn't wait behind a long one,
+// and nested calls from inside a task are safe: a caller can always finish
+// its chunks alone.
+class ThreadPool {
+public:
+    // thread_count of 0 means one per hardware thread
+    explicit ThreadPool(size_t thread_count = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // Finishes the tasks already queued
+    ~ThreadPool();
+
+    size_t GetThreadCount() const;
+
+    // Calls function(i) for every i in [0, count) and returns once all the
+    // calls have. Indexes are claimed in chunks of about count / (4 *
+    // threads) by the caller and by up to one task per worker, so uneven
+    // calls even out without a task per index. The first exception thrown
+    // is rethrown here once the other calls are done.
+    template <typename Function>
+    void ParallelFor(size_t count, Function function);
+
+    using Task = std::function<void()>;
+
+    // Queues task without waiting for it. A task submitted by a worker goes
+    // to that worker's deque. Exceptions must not escape task.
+    void Submit(Task task);
+
+    // Pool of the parallel overloads, created on first use with one thread
+    // per hardware thread
+    static std::shared_ptr<ThreadPool> GetDefault();
+    // Replaces the default pool; calls running on the old one finish there
+    static void SetDefaultThreadCount(size_t thread_count);
+
+private:
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Chunks of one ParallelFor call. Shared with the tasks that help with
+    // it, which may only start once the call has returned and then find
+    // nothing left to claim.
+    struct Batch {
+        std::atomic<size_t> next_chunk{ 0 };
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending = 0;  // chunks not finished yet
+        std::exception_ptr exception;
+    };
+
+    // Runs one queued task in the calling worker, its own newest one or the
+    // oldest one stolen from another. Returns false if every deque is empty.
+    bool RunPendingTask();
+    void RunWorker(size_t index);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_worker_{ 0 };  // where tasks from outside go
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_{ 0 };
+    bool is_stopping_ = false;
+};
+
+template <typename Function>
+void ThreadPool::ParallelFor(size_t count, Function function) {
+    if (count == 0) {
+        return;
+    }
+    const size_t chunk_size = std::max<size_t>(1, count / (4 * workers_.size()));
+    const size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+    if (chunk_count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            function(i);
+        }
+        return;
+    }
+
+    const auto batch = std::make_shared<Batch>();
+    batch->pending = chunk_count;
+    // Runs chunks until there are none left to claim; function is only
+    // touched after a claim, while the call is still waiting for it
+    const auto run_chunks = [batch = batch.get(), &function, count, chunk_size, chunk_count] {
+        for (size_t chunk = batch->next_chunk.fetch_add(1, std::memory_order_relaxed); chunk < chunk_count;
+            chunk = batch->next_chunk.fetch_add(1, std::memory_order_relaxed))
+        {
+            std::exception_ptr exception;
+            try {
+                for (size_t i = chunk * chunk_size, end = std::min(count, (chunk + 1) * chunk_size); i < end; ++i) {
+                    function(i);
+                }
+            }
+            catch (...) {
+                exception = std::current_exception();
+            }
+            std::lock_guard lock(batch->mutex);
+            if (exception && !batch->exception) {
+                batch->exception = exception;
+            }
+            if (--batch->pending == 0) {
+                batch->done.notify_all();
+            }
+        }
+    };
+    const size_t helper_count = std::min(workers_.size(), chunk_count - 1);
+    for (size_t i = 0; i < helper_count; ++i) {
+        Submit([batch, run_chunks] { run_chunks(); });
+    }
+    run_chunks();
+    {
+        std::unique_lock lock(batch->mutex);
+        batch->done.wait(lock, [&batch] { return batch->pending == 0; });
+    }
+    if (batch->exception) {
+        std::rethrow_exception(batch->exception);
+    }
+}
+
+// std::for_each with the parallel policy run on the default ThreadPool
+template <typename RandomAccessIterator, typename Function>
+void ForEach(std::execution::parallel_policy, RandomAccessIterator first, RandomAccessIterator last,
+    Function function)
+{
+    ThreadPool::GetDefault()->ParallelFor(static_cast<size_t>(std::distance(first, last)),
+        [first, &function](size_t i) { function(first[i]); });
+}
+
+template <typename Iterator, typename Function>
+void ForEach(std::execution::sequenced_policy, Iterator first, Iterator last, Function function) {
+    std::for_each(first, last, function);
+}
@@ -0,0 +1,51 @@
+#include "top_documents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (abs(lhs.relevance - rhs.relevance) < EPSILON) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.id < rhs.id;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+TopDocumentsCollector::TopDocumentsCollector(size_t max_count)
+    : max_count_(max_count)
+{
+    // max_count may be far beyond the number of matches, even SIZE_MAX for
+    // "all of them", so only the usual page size is reserved
+    heap_.reserve(min(max_count, size_t{ INITIAL_CAPACITY }));
+}
+
+void TopDocumentsCollector::Offer(const Document& document) {
+    if (heap_.size() < max_count_) {
+        heap_.push_back(document);
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        return;
+    }
+    if (max_count_ > 0 && IsMoreRelevant(document, heap_.front())) {
+        pop_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        heap_.back() = document;
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    }
+}
+
+bool TopDocumentsCollector::IsFull() const {
+    return heap_.size() == max_count_;
+}
+
+const Document& TopDocumentsCollector::GetWorst() const {
+    return heap_.front();
+}
+
+vector<Document> TopDocumentsCollector::Extract() {
+    sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    return move(heap_);
+}
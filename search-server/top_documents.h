@@ -0,0 +1,35 @@
+#pragma once
+#include "document.h"
+
+#include <cstddef>
+#include <vector>
+
+// Ranking order of search results: higher relevance first, documents whose
+// relevances differ by less than EPSILON are ordered by rating and then by
+// id, so the order never depends on how the candidates were produced.
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+// Keeps the max_count best documents offered so far in a heap whose top is
+// the worst kept one, so selecting from M candidates costs O(M log K)
+// instead of sorting all of them. Memory grows with the documents kept,
+// not with max_count; a max_count of 0 keeps none.
+class TopDocumentsCollector {
+public:
+    explicit TopDocumentsCollector(size_t max_count);
+
+    void Offer(const Document& document);
+
+    bool IsFull() const;
+
+    // The document a newcomer has to beat. Requires IsFull().
+    const Document& GetWorst() const;
+
+    // Kept documents ordered best first. Leaves the collector empty.
+    std::vector<Document> Extract();
+
+private:
+    static const size_t INITIAL_CAPACITY = 64;
+
+    size_t max_count_;
+    std::vector<Document> heap_;
+};